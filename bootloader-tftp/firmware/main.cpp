@@ -35,6 +35,7 @@
 #include "firmwareversion.h"
 #include "software_version.h"
 #include "flashcodeinstall.h"
+#include "firmwaretrailer.h"
 #include "configstore.h"
 
 #include "gd32.h"
@@ -71,7 +72,39 @@ int main()
     const auto kIsNotRemote = (bkp_data_read(BKP_DATA_1) != 0xA5A5);
     const auto kIsNotKey = (gpio_input_bit_get(KEY_BOOTLOADER_TFTP_GPIOx, KEY_BOOTLOADER_TFTP_GPIO_PINx));
 
-    if (kIsNotRemote && kIsNotKey)
+#if defined(CONFIG_HAVE_CRC32_HW)
+    // crc32 is used before hal::Init
+    rcu_periph_clock_enable(RCU_CRC);
+#endif
+
+    const auto kIsBoot = kIsNotRemote && kIsNotKey;
+
+#if defined(OFFSET_SLOT_B)
+    // A verified image in slot B is activated first, followed by a reboot
+    const auto kIsActivate = kIsBoot && firmware::trailer::IsVerified(reinterpret_cast<const uint8_t*>(FLASH_BASE + OFFSET_SLOT_B), FIRMWARE_MAX_SIZE);
+#else
+    constexpr auto kIsActivate = false;
+#endif
+
+    // An erased vector table means there is no firmware, an image without trailer is started as before
+    auto image_status = firmware::trailer::Status::kInvalid;
+
+    if (kIsBoot && !kIsActivate && (*reinterpret_cast<const uint32_t*>(FLASH_BASE + OFFSET_UIMAGE) != 0xFFFFFFFF))
+    {
+        const auto* const kImage = reinterpret_cast<const uint8_t*>(FLASH_BASE + OFFSET_UIMAGE);
+
+        // The whole image is only checked when there is no boot record from a verified install
+        if (firmware::trailer::IsVerified(kImage, FIRMWARE_MAX_SIZE))
+        {
+            image_status = firmware::trailer::Status::kValid;
+        }
+        else
+        {
+            image_status = firmware::trailer::Verify(kImage, FIRMWARE_MAX_SIZE);
+        }
+    }
+
+    if (kIsBoot && !kIsActivate && (image_status != firmware::trailer::Status::kInvalid))
     {
         // https://developer.arm.com/documentation/ka001423/1-0
         // 1. Disable interrupt response.
@@ -108,8 +141,25 @@ int main()
     network::Init();
     FirmwareVersion fw(SOFTWARE_VERSION, __DATE__, __TIME__);
     FlashCodeInstall flashcode_install;
+    // ARP and ping are answered while the flash is busy
+    FlashCode::SetBusyHook(emac_eth_recv_ram);
 
     printf("Remote=%c, Key=%c\n", kIsNotRemote ? 'N' : 'Y', kIsNotKey ? 'N' : 'Y');
+
+    if (kIsActivate)
+    {
+        if (flashcode_install.ActivateSlot())
+        {
+            hal::Reboot();
+        }
+
+        // Slot B stays marked, the copy is tried again at the next boot
+        puts("Error: slot B could not be activated");
+    }
+    else if (kIsBoot)
+    {
+        puts("Error: firmware is missing or the CRC does not match");
+    }
     fw.Print("Bootloader TFTP Server");
 
     RemoteConfig remote_config(remoteconfig::Output::CONFIG);
@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+#
+# Appends the firmware trailer to a binary image, see lib-flashcodeinstall/include/firmwaretrailer.h
+# The image is padded with 0xFF to a whole number of words first.
+# The crc32 is taken from the gzip footer, so only coreutils and gzip are needed.
+#
+# Usage: add-trailer.sh <file.bin>
+
+set -e
+
+if [ $# -ne 1 ] || [ ! -f "$1" ]; then
+	echo "Usage: $0 file.bin" >&2
+	exit 1
+fi
+
+FILE=$1
+
+# Prints a 32-bit value as 4 bytes, little endian
+le32() {
+	printf "\\$(printf '%03o' $(( $1 & 0xFF )))"
+	printf "\\$(printf '%03o' $(( ($1 >> 8) & 0xFF )))"
+	printf "\\$(printf '%03o' $(( ($1 >> 16) & 0xFF )))"
+	printf "\\$(printf '%03o' $(( ($1 >> 24) & 0xFF )))"
+}
+
+SIZE=$(wc -c < "$FILE")
+
+while [ $(( SIZE % 4 )) -ne 0 ]; do
+	printf '\377' >> "$FILE"
+	SIZE=$(( SIZE + 1 ))
+done
+
+# "FWTR"
+le32 0x52545746 >> "$FILE"
+le32 "$SIZE" >> "$FILE"
+
+gzip -c < "$FILE" | tail -c 8 | head -c 4 >> "$FILE"
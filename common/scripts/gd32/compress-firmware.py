@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+compress-firmware.py
+
+Compresses a firmware image, with its trailer, into an LZ4 frame that the
+bootloader decompresses while programming the flash (no external dependencies).
+The compressed file gets a trailer of its own, which is checked when received.
+
+Usage:
+  python3 compress-firmware.py <file.bin> <file.lz4>
+
+The input must have the trailer already, see add-trailer.sh.
+The output is uploaded with do-tftp.py, as any other firmware file.
+"""
+
+from __future__ import annotations
+
+import struct
+import sys
+import zlib
+
+LZ4_MAGIC = 0x184D2204
+TRAILER_MAGIC = 0x52545746  # "FWTR"
+
+MIN_MATCH = 4
+MAX_OFFSET = 65535
+LAST_LITERALS = 5
+MF_LIMIT = 12
+
+PRIME32_1 = 0x9E3779B1
+PRIME32_2 = 0x85EBCA77
+PRIME32_3 = 0xC2B2AE3D
+PRIME32_4 = 0x27D4EB2F
+PRIME32_5 = 0x165667B1
+MASK32 = 0xFFFFFFFF
+
+
+def _rotl32(x: int, r: int) -> int:
+    return ((x << r) | (x >> (32 - r))) & MASK32
+
+
+def _xxh32(data: bytes, seed: int = 0) -> int:
+    """
+    xxHash32, only used on the few bytes of the frame descriptor.
+    """
+    assert len(data) < 16
+    h = (seed + PRIME32_5 + len(data)) & MASK32
+    i = 0
+    while i + 4 <= len(data):
+        h = (h + struct.unpack_from("<I", data, i)[0] * PRIME32_3) & MASK32
+        h = (_rotl32(h, 17) * PRIME32_4) & MASK32
+        i += 4
+    while i < len(data):
+        h = (h + data[i] * PRIME32_5) & MASK32
+        h = (_rotl32(h, 11) * PRIME32_1) & MASK32
+        i += 1
+    h ^= h >> 15
+    h = (h * PRIME32_2) & MASK32
+    h ^= h >> 13
+    h = (h * PRIME32_3) & MASK32
+    h ^= h >> 16
+    return h
+
+
+def _length(out: bytearray, value: int) -> None:
+    while value >= 255:
+        out.append(255)
+        value -= 255
+    out.append(value)
+
+
+def _sequence(out: bytearray, literals: bytes, offset: int, match_length: int) -> None:
+    literal_length = len(literals)
+    token = min(literal_length, 15) << 4
+    if offset != 0:
+        token |= min(match_length - MIN_MATCH, 15)
+    out.append(token)
+    if literal_length >= 15:
+        _length(out, literal_length - 15)
+    out += literals
+    if offset != 0:
+        out += struct.pack("<H", offset)
+        if match_length - MIN_MATCH >= 15:
+            _length(out, match_length - MIN_MATCH - 15)
+
+
+def compress_block(src: bytes) -> bytes:
+    """
+    Greedy LZ4 block compression, the whole image is a single block.
+    """
+    out = bytearray()
+    table: dict[bytes, int] = {}
+    anchor = 0
+    i = 0
+    n = len(src)
+
+    while i < n - MF_LIMIT:
+        key = src[i:i + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+
+        match_length = MIN_MATCH
+        max_length = n - LAST_LITERALS - i
+        while match_length < max_length and src[candidate + match_length] == src[i + match_length]:
+            match_length += 1
+
+        _sequence(out, src[anchor:i], i - candidate, match_length)
+
+        for j in range(i + 1, min(i + match_length, n - MIN_MATCH)):
+            table[src[j:j + MIN_MATCH]] = j
+
+        i += match_length
+        anchor = i
+
+    _sequence(out, src[anchor:], 0, 0)
+    return bytes(out)
+
+
+def compress_frame(src: bytes) -> bytes:
+    # Version 01, independent blocks, no checksums, 4 MB blocks
+    descriptor = bytes([0x60, 0x70])
+    out = bytearray(struct.pack("<I", LZ4_MAGIC))
+    out += descriptor
+    out.append((_xxh32(descriptor) >> 8) & 0xFF)
+
+    block = compress_block(src)
+    if len(block) < len(src):
+        out += struct.pack("<I", len(block))
+        out += block
+    else:
+        # Stored
+        out += struct.pack("<I", len(src) | 0x80000000)
+        out += src
+
+    out += struct.pack("<I", 0)  # End mark
+    return bytes(out)
+
+
+def add_trailer(data: bytes) -> bytes:
+    """
+    As add-trailer.sh
+    """
+    data += b"\xff" * (-len(data) % 4)
+    data += struct.pack("<II", TRAILER_MAGIC, len(data))
+    return data + struct.pack("<I", zlib.crc32(data))
+
+
+def main() -> int:
+    if len(sys.argv) != 3:
+        print(f"Usage: {sys.argv[0]} file.bin file.lz4", file=sys.stderr)
+        return 1
+
+    with open(sys.argv[1], "rb") as f:
+        image = f.read()
+
+    frame = add_trailer(compress_frame(image))
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(frame)
+
+    print(f"{sys.argv[1]}: {len(image)} -> {len(frame)} bytes ({100 * len(frame) // max(len(image), 1)}%)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""
+make-patch.py
+
+Makes a delta firmware file, that turns the installed firmware into the new one
+(no external dependencies). See lib-flashcodeinstall/include/firmwarepatch.h
+
+Usage:
+  python3 make-patch.py [--in-place] <old.bin> <new.bin> <file.patch>
+
+Both images must have the trailer already, see add-trailer.sh.
+The output is uploaded with do-tftp.py, as any other firmware file.
+
+The matching follows bsdiff: a match is extended while it is mostly equal,
+the differences are sent as add bytes. This keeps code that only moved, with
+its addresses changed, small.
+
+By default the patch is installed in the second slot, while the old image
+stays in the first. With --in-place the old image is never read from a sector
+that has been written already, for a device without a second slot. Code that
+moved to a higher address then costs literal bytes at the start of each sector.
+"""
+
+from __future__ import annotations
+
+import struct
+import sys
+import zlib
+
+PATCH_MAGIC = 0x50445746  # "FWDP"
+TRAILER_MAGIC = 0x52545746  # "FWTR"
+
+OP_END = 0
+OP_COPY = 1
+OP_ADD = 2
+OP_INSERT = 3
+OP_SEEK = 4
+
+FLAG_IN_PLACE = 0x1
+
+OP_SHIFT = 5
+LENGTH_MAX = 31  # Longer lengths are followed by a varint
+
+SECTOR_SIZE = 4096  # The stream buffer of FlashCodeInstall
+KEY_SIZE = 8
+MAX_CANDIDATES = 8
+MIN_SCORE = 16
+MIN_COPY = 8
+
+
+def _varint(out: bytearray, value: int) -> None:
+    assert 0 <= value < (1 << 32)
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def _op(out: bytearray, op: int, value: int, data: bytes = b"") -> None:
+    if value < LENGTH_MAX:
+        out.append((op << OP_SHIFT) | value)
+    else:
+        out.append((op << OP_SHIFT) | LENGTH_MAX)
+        _varint(out, value - LENGTH_MAX)
+    out += data
+
+
+def _zigzag(value: int) -> int:
+    return ((value << 1) ^ (value >> 31)) & 0xFFFFFFFF
+
+
+def _in_place_length(old_pos: int, new_pos: int, length: int) -> int:
+    """
+    Limits a match to the old bytes that are still in the flash,
+    the sector of the new position and anything before it has been written.
+    """
+    k = 0
+    while k < length:
+        if old_pos + k < (new_pos + k) // SECTOR_SIZE * SECTOR_SIZE:
+            return k
+        # Next sector boundary of the new position
+        k += SECTOR_SIZE - (new_pos + k) % SECTOR_SIZE
+    return length
+
+
+def _extend(old: bytes, new: bytes, old_pos: int, new_pos: int, limit: int) -> tuple[int, int]:
+    """
+    Returns the length with the best score, where a match counts +1 and a mismatch -1.
+    """
+    score = 0
+    best_score = 0
+    best_length = 0
+    k = 0
+    while k < limit:
+        # Equal stretches are compared a block at a time
+        if k + 64 <= limit and old[old_pos + k:old_pos + k + 64] == new[new_pos + k:new_pos + k + 64]:
+            score += 64
+            k += 64
+        else:
+            score += 1 if old[old_pos + k] == new[new_pos + k] else -1
+            k += 1
+        if score > best_score:
+            best_score = score
+            best_length = k
+        elif k - best_length > 64:
+            break
+    return best_length, best_score
+
+
+def _emit_match(out: bytearray, old: bytes, new: bytes, old_pos: int, new_pos: int, length: int) -> None:
+    """
+    Equal runs become copy, the rest becomes add.
+    """
+    k = 0
+    while k < length:
+        j = k
+        while j < length and old[old_pos + j] == new[new_pos + j]:
+            j += 1
+        if j - k >= MIN_COPY or j == length:
+            if j > k:
+                _op(out, OP_COPY, j - k)
+            k = j
+            continue
+        # Add until the next equal run that is worth a copy
+        j = k
+        while j < length:
+            run = 0
+            while j + run < length and run < MIN_COPY and old[old_pos + j + run] == new[new_pos + j + run]:
+                run += 1
+            if run >= MIN_COPY:
+                break
+            j += max(run, 1)
+        diff = bytes((new[new_pos + x] - old[old_pos + x]) & 0xFF for x in range(k, j))
+        _op(out, OP_ADD, len(diff), diff)
+        k = j
+
+
+def make_patch(old: bytes, new: bytes, in_place: bool) -> bytes:
+    index: dict[bytes, list[int]] = {}
+    for i in range(len(old) - KEY_SIZE + 1):
+        index.setdefault(old[i:i + KEY_SIZE], []).append(i)
+
+    flags = FLAG_IN_PLACE if in_place else 0
+    out = bytearray(struct.pack("<IIIII", PATCH_MAGIC, flags, len(old), struct.unpack_from("<I", old, len(old) - 4)[0], len(new)))
+    literals = bytearray()
+    old_pos = 0
+    new_pos = 0
+
+    while new_pos < len(new):
+        # The old position that follows the previous match is tried first
+        candidates = [old_pos] if old_pos < len(old) else []
+        candidates += index.get(new[new_pos:new_pos + KEY_SIZE], [])[-MAX_CANDIDATES:]
+
+        best = (0, 0, 0)
+        for candidate in candidates:
+            limit = min(len(old) - candidate, len(new) - new_pos)
+            if in_place:
+                limit = _in_place_length(candidate, new_pos, limit)
+            length, score = _extend(old, new, candidate, new_pos, limit)
+            if length != 0 and score > best[2]:
+                best = (candidate, length, score)
+
+        candidate, length, score = best
+
+        if score < MIN_SCORE:
+            literals.append(new[new_pos])
+            new_pos += 1
+            continue
+
+        if literals:
+            _op(out, OP_INSERT, len(literals), bytes(literals))
+            literals = bytearray()
+
+        if candidate != old_pos:
+            _op(out, OP_SEEK, _zigzag(candidate - old_pos))
+
+        _emit_match(out, old, new, candidate, new_pos, length)
+        old_pos = candidate + length
+        new_pos += length
+
+    if literals:
+        _op(out, OP_INSERT, len(literals), bytes(literals))
+
+    out.append(OP_END)
+    return bytes(out)
+
+
+def add_trailer(data: bytes) -> bytes:
+    """
+    As add-trailer.sh
+    """
+    data += b"\xff" * (-len(data) % 4)
+    data += struct.pack("<II", TRAILER_MAGIC, len(data))
+    return data + struct.pack("<I", zlib.crc32(data))
+
+
+def _has_trailer(image: bytes) -> bool:
+    if len(image) < 12:
+        return False
+    magic, length = struct.unpack_from("<II", image, len(image) - 12)
+    return magic == TRAILER_MAGIC and length == len(image) - 12 and zlib.crc32(image) == 0x2144DF1C
+
+
+def main() -> int:
+    args = sys.argv[1:]
+    in_place = "--in-place" in args
+    if in_place:
+        args.remove("--in-place")
+
+    if len(args) != 3:
+        print(f"Usage: {sys.argv[0]} [--in-place] old.bin new.bin file.patch", file=sys.stderr)
+        return 1
+
+    with open(args[0], "rb") as f:
+        old = f.read()
+    with open(args[1], "rb") as f:
+        new = f.read()
+
+    for name, image in ((args[0], old), (args[1], new)):
+        if not _has_trailer(image):
+            print(f"{name}: no firmware trailer, run add-trailer.sh first", file=sys.stderr)
+            return 1
+
+    patch = add_trailer(make_patch(old, new, in_place))
+
+    with open(args[2], "wb") as f:
+        f.write(patch)
+
+    print(f"{args[1]}: {len(new)} -> {len(patch)} bytes ({100 * len(patch) // max(len(new), 1)}%)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -11,6 +11,9 @@ AR	 = $(PREFIX)ar
 BOARD?=BOARD_GD32F107RC
 ENET_PHY?=DP83848
 
+# The CRC32 trailer is checked by the bootloader before it starts an application image
+FIRMWARE_TRAILER?=1
+
 TARGET=gd32f107.bin
 LIST=$(FAMILY).list
 MAP=$(FAMILY).map
@@ -88,7 +91,7 @@ endef
 
 all : builddirs prerequisites $(TARGET)
 
-.PHONY: clean builddirs
+.PHONY: clean builddirs lz4
 
 builddirs:
 	mkdir -p $(BUILD_DIRS)
@@ -98,6 +101,7 @@ builddirs:
 clean: $(LIBDEP)
 	rm -rf $(BUILD)
 	rm -f $(TARGET)
+	rm -f $(TARGET:.bin=.lz4)
 	rm -f $(MAP)
 	rm -f $(LIST)
 	rm -f $(SIZE)
@@ -133,5 +137,14 @@ $(BUILD)main.elf: Makefile.GD32 $(LINKER) $(BUILD)startup_$(LINE).o $(BUILD)hard
 
 $(TARGET) : $(BUILD)main.elf
 	$(PREFIX)objcopy $(BUILD)main.elf -O binary $(TARGET) --remove-section=.tcmsram* --remove-section=.sram1* --remove-section=.sram2* --remove-section=.ramadd* --remove-section=.bkpsram*
+ifeq ($(strip $(FIRMWARE_TRAILER)),1)
+	$(FIRMWARE_DIR)/../common/scripts/gd32/add-trailer.sh $(TARGET)
+endif
+
+# Compressed firmware, uploaded with the name of $(TARGET)
+$(TARGET:.bin=.lz4) : $(TARGET)
+	python3 $(FIRMWARE_DIR)/../common/scripts/gd32/compress-firmware.py $(TARGET) $@
+
+lz4 : $(TARGET:.bin=.lz4)
 
 $(foreach bdir,$(SRCDIR),$(eval $(call compile-objects,$(bdir))))
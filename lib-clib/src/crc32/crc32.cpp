@@ -18,6 +18,16 @@
 
 #define CONFIG_DYNAMIC_CRC_TABLE
 
+/*
+ * Backends:
+ * - GD32 with CONFIG_HAVE_CRC32_HW uses the CRC unit, see src/gd32/crc32
+ * - H3 and Linux use slicing-by-8, 8 bytes per iteration with 8K of tables
+ * - Otherwise a table lookup per byte, as the 8K does not fit the flash budget
+ */
+#if (defined(H3) || defined(__linux__) || defined(__APPLE__)) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+# define CRC32_SLICING_BY_8
+#endif
+
 #ifndef CONFIG_DYNAMIC_CRC_TABLE
  /* ========================================================================
   * Table of CRC-32's of all single-byte values (made by make_crc_table)
@@ -91,6 +101,10 @@ static constexpr uint32_t crc_table[256] = {
 #else
 static int crc_table_empty = 1;
 static uint32_t crc_table[256];
+#if defined(CRC32_SLICING_BY_8)
+/* crc_table_slice[k - 1][n] is the CRC of byte n followed by k zero bytes */
+static uint32_t crc_table_slice[7][256];
+#endif
 
 /*
   Generate a table for a byte-wise 32-bit CRC calculation on the polynomial:
@@ -132,6 +146,15 @@ static void make_crc_table() {
 		}
 		crc_table[n] = c;
 	}
+#if defined(CRC32_SLICING_BY_8)
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = crc_table[n];
+		for (uint32_t k = 0; k < 7; k++) {
+			c = crc_table[c & 0xff] ^ (c >> 8);
+			crc_table_slice[k][n] = c;
+		}
+	}
+#endif
 	crc_table_empty = 0;
 }
 #endif
@@ -143,20 +166,30 @@ uint32_t crc32(uint32_t crc, const uint8_t *buf, uint32_t len) {
 
 	const auto *tab = crc_table;
 	const auto *b = reinterpret_cast<const uint32_t *>(buf);
-	size_t rem_len;
+	uint32_t rem_len;
 #ifdef CONFIG_DYNAMIC_CRC_TABLE
     if (crc_table_empty)
       make_crc_table();
 #endif
 	/* Align it */
-	if (((reinterpret_cast<long>(b)) & 3) && len) {
+	if (((reinterpret_cast<uintptr_t>(b)) & 3) && len) {
 		auto *p = reinterpret_cast<const uint8_t *>(b);
 		do {
 			DO_CRC(*p++);
-		} while ((--len) && ((reinterpret_cast<long>(b)) & 3));
+		} while ((--len) && ((reinterpret_cast<uintptr_t>(p)) & 3));
 		b = reinterpret_cast<const uint32_t *>(p);
 	}
 
+#if defined(CRC32_SLICING_BY_8)
+	const auto *s = crc_table_slice;
+	for (; len >= 8; len -= 8) {
+		const auto one = *b++ ^ crc;
+		const auto two = *b++;
+		crc = s[6][one & 255] ^ s[5][(one >> 8) & 255] ^ s[4][(one >> 16) & 255] ^ s[3][one >> 24] ^
+		      s[2][two & 255] ^ s[1][(two >> 8) & 255] ^ s[0][(two >> 16) & 255] ^ tab[two >> 24];
+	}
+#endif
+
 	rem_len = len & 3;
 	len = len >> 2;
 	for (--b; len; --len) {
@@ -0,0 +1,99 @@
+/**
+ * @file crc32.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma GCC push_options
+#pragma GCC optimize("O2")
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+#include <cstdint>
+
+#include "gd32.h"
+
+/*
+ * The CRC unit uses the same polynomial as zlib, but shifts the most significant bit first,
+ * always starts from 0xFFFFFFFF and has no final xor. The zlib (reflected) CRC-32 is obtained
+ * by bit-reversing the data words and the result.
+ *
+ * The register is linear, so a running crc is continued by xor-ing the difference between the
+ * wanted start value and 0xFFFFFFFF into the first data word.
+ *
+ * The clock of the CRC unit is enabled by hal::Init, or by main when crc32 is used before.
+ * Not reentrant, crc32 must not be used from an interrupt handler.
+ */
+
+static constexpr uint32_t kPolynomial = 0xEDB88320;
+
+/*
+ * Unaligned head and the tail, at most 3 bytes each.
+ */
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    while (len-- != 0)
+    {
+        crc ^= *buf++;
+
+        for (uint32_t k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (kPolynomial ^ (crc >> 1)) : (crc >> 1);
+        }
+    }
+
+    return crc;
+}
+
+uint32_t crc32(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = crc ^ 0xFFFFFFFF;
+
+    while (((reinterpret_cast<uintptr_t>(buf) & 3) != 0) && (len != 0))
+    {
+        crc = crc32_bytes(crc, buf++, 1);
+        len--;
+    }
+
+    auto words = len >> 2;
+
+    if (words != 0)
+    {
+        const auto* word = reinterpret_cast<const uint32_t*>(buf);
+
+        CRC_CTL = CRC_CTL_RST;
+        CRC_DATA = __RBIT(*word++ ^ crc ^ 0xFFFFFFFF);
+
+        while (--words != 0)
+        {
+            CRC_DATA = __RBIT(*word++);
+        }
+
+        crc = __RBIT(CRC_DATA);
+        buf = reinterpret_cast<const uint8_t*>(word);
+    }
+
+    crc = crc32_bytes(crc, buf, len & 3);
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+#pragma GCC pop_options
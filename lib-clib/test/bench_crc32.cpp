@@ -0,0 +1,173 @@
+/**
+ * @file bench_crc32.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark of crc32, slicing-by-8 against the table lookup per byte it replaced.
+ * The results are checked against each other first, for any alignment and split.
+ *
+ * cd lib-clib/test
+ * g++ -std=c++20 -O2 -Wall -Wextra -Werror bench_crc32.cpp ../src/crc32/crc32.cpp -o bench_crc32 && ./bench_crc32
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+uint32_t crc32(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+/*
+ * The byte table crc32, as it was before slicing-by-8.
+ * The alignment loop tested the pointer it did not advance, so an unaligned buffer
+ * was done a byte at a time.
+ */
+namespace bytetable
+{
+static uint32_t s_table[256];
+
+static void MakeTable()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        auto c = n;
+
+        for (uint32_t k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+
+        s_table[n] = c;
+    }
+}
+
+#define DO_CRC(x) crc = s_table[(crc ^ (x)) & 255] ^ (crc >> 8)
+
+__attribute__((noinline)) static uint32_t Crc32(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = crc ^ 0xffffffff;
+
+    const auto* b = reinterpret_cast<const uint32_t*>(buf);
+
+    if (((reinterpret_cast<uintptr_t>(b)) & 3) && len)
+    {
+        auto* p = reinterpret_cast<const uint8_t*>(b);
+        do
+        {
+            DO_CRC(*p++);
+        } while ((--len) && ((reinterpret_cast<uintptr_t>(b)) & 3));
+        b = reinterpret_cast<const uint32_t*>(p);
+    }
+
+    const auto kRemaining = len & 3;
+    len = len >> 2;
+
+    for (--b; len; --len)
+    {
+        crc ^= *++b;
+        DO_CRC(0);
+        DO_CRC(0);
+        DO_CRC(0);
+        DO_CRC(0);
+    }
+
+    if (kRemaining != 0)
+    {
+        auto* p = reinterpret_cast<const uint8_t*>(b + 1);
+        for (uint32_t i = 0; i < kRemaining; i++)
+        {
+            DO_CRC(*p++);
+        }
+    }
+
+    return crc ^ 0xffffffff;
+}
+
+#undef DO_CRC
+} // namespace bytetable
+
+namespace bench
+{
+static constexpr uint32_t kBufferSize = 1024 * 1024;
+static constexpr uint32_t kRuns = 100;
+static uint8_t s_buffer[kBufferSize + 8] __attribute__((aligned(8)));
+
+typedef uint32_t (*Crc32)(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+static void Run(const char* name, Crc32 crc32, uint32_t offset)
+{
+    uint32_t crc = 0;
+
+    const auto kStart = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < kRuns; i++)
+    {
+        crc = crc32(crc, &s_buffer[offset], kBufferSize);
+    }
+
+    const std::chrono::duration<double> kSeconds = std::chrono::steady_clock::now() - kStart;
+
+    printf("%-11s offset %u: %7.1f MB/s (%08x)\n", name, static_cast<unsigned int>(offset), (static_cast<double>(kRuns) * kBufferSize) / kSeconds.count() / 1e6, static_cast<unsigned int>(crc));
+}
+} // namespace bench
+
+int main()
+{
+    bytetable::MakeTable();
+
+    srand(1);
+
+    for (auto& c : bench::s_buffer)
+    {
+        c = static_cast<uint8_t>(rand());
+    }
+
+    if (crc32(0, reinterpret_cast<const uint8_t*>("123456789"), 9) != 0xCBF43926)
+    {
+        puts("FAIL: check value");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        const auto kOffset = static_cast<uint32_t>(rand()) % 8;
+        const auto kLength = static_cast<uint32_t>(rand()) % 3000;
+        const auto kSplit = (kLength != 0) ? static_cast<uint32_t>(rand()) % kLength : 0;
+        const auto* const kData = &bench::s_buffer[kOffset];
+
+        if (crc32(crc32(0, kData, kSplit), &kData[kSplit], kLength - kSplit) != bytetable::Crc32(0, kData, kLength))
+        {
+            printf("FAIL: offset %u, length %u, split %u\n", static_cast<unsigned int>(kOffset), static_cast<unsigned int>(kLength), static_cast<unsigned int>(kSplit));
+            return 1;
+        }
+    }
+
+    for (uint32_t offset = 0; offset < 2; offset++)
+    {
+        bench::Run("byte table", bytetable::Crc32, offset);
+        bench::Run("crc32", crc32, offset);
+    }
+
+    return 0;
+}
@@ -27,8 +27,50 @@
 
 #include "configstoredevice.h"
 #include "flashcode.h"
+#include "flashcodejobs.h"
 #include "firmware/debug/debug_debug.h"
 
+namespace storedevice
+{
+static bool s_is_submitted;
+static bool s_is_done;
+static flashcode::Result s_result;
+
+static void Done(const flashcode::jobs::Job& job)
+{
+    s_result = job.result;
+    s_is_done = true;
+}
+
+/*
+ * The flash is shared with the firmware install, so the erase and write are done by the flash job queue.
+ * The queue is also run from here, as ConfigstoreCommit polls without the superloop.
+ */
+static bool Poll(flashcode::jobs::Type type, uint32_t offset, uint32_t length, const uint8_t* buffer, Result& result)
+{
+    result = Result::kOk;
+
+    if (!s_is_submitted)
+    {
+        s_is_done = false;
+        s_is_submitted = flashcode::jobs::Submit(type, offset, length, buffer, Done);
+        return false;
+    }
+
+    flashcode::jobs::Run();
+
+    if (!s_is_done)
+    {
+        return false;
+    }
+
+    s_is_submitted = false;
+    result = static_cast<Result>(s_result);
+
+    return true;
+}
+} // namespace storedevice
+
 StoreDevice::StoreDevice()
 {
     DEBUG_ENTRY();
@@ -71,10 +113,7 @@ bool StoreDevice::Erase(uint32_t offset, uint32_t length, storedevice::Result& r
 {
     DEBUG_ENTRY();
 
-    flashcode::Result flashrom_result;
-    const auto kState = FlashCode::Erase(offset, length, flashrom_result);
-
-    result = static_cast<storedevice::Result>(flashrom_result);
+    const auto kState = storedevice::Poll(flashcode::jobs::Type::kErase, offset, length, nullptr, result);
 
     DEBUG_EXIT();
     return kState;
@@ -84,10 +123,7 @@ bool StoreDevice::Write(uint32_t offset, uint32_t length, const uint8_t* buffer,
 {
     DEBUG_ENTRY();
 
-    flashcode::Result flashrom_result;
-    const auto kState = FlashCode::Write(offset, length, buffer, flashrom_result);
-
-    result = static_cast<storedevice::Result>(flashrom_result);
+    const auto kState = storedevice::Poll(flashcode::jobs::Type::kProgram, offset, length, buffer, result);
 
     DEBUG_EXIT();
     return kState;
@@ -35,6 +35,12 @@ enum class Result
     kOk,
     kError
 };
+
+/*
+ * Called while the flash is busy and the CPU would otherwise stall.
+ * It runs with the interrupts disabled and must be placed in RAM, together with everything it calls.
+ */
+typedef void (*BusyHook)();
 } // namespace flashcode
 
 class FlashCode
@@ -52,6 +58,13 @@ class FlashCode
     bool Read(uint32_t offset, uint32_t length, uint8_t* buffer, flashcode::Result& result);
     bool Erase(uint32_t offset, uint32_t length, flashcode::Result& result);
     bool Write(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result);
+    /*
+     * Programs a flash page per call, returns false until done.
+     * Platforms without a page programming engine fall back to Write.
+     */
+    bool WriteBulk(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result);
+
+    static void SetBusyHook(flashcode::BusyHook hook);
 
     static FlashCode* Get() { return s_this; }
 
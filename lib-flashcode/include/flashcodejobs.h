@@ -0,0 +1,105 @@
+/**
+ * @file flashcodejobs.h
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FLASHCODEJOBS_H_
+#define FLASHCODEJOBS_H_
+
+#include <cstdint>
+
+#include "flashcode.h"
+
+/*
+ * Flash job queue, the jobs are done in order of submission.
+ * The queue is serviced a time slice at a time by a software timer from the superloop,
+ * so the network and the watchdog keep running during long erases.
+ * All flash work must go through the queue, as FlashCode can only do one operation at a time.
+ */
+namespace flashcode::jobs
+{
+static constexpr uint32_t kMaxJobs = 8;
+
+enum class Type
+{
+    kErase,
+    kProgram,
+    kVerify, ///< Compares the flash with the buffer
+    kCrc     ///< crc32 of the flash content
+};
+
+struct Job;
+
+typedef void (*Callback)(const Job& job);
+
+struct Job
+{
+    Type type;
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t* buffer;
+    Callback done;     ///< Called when the job has finished, also on error
+    Callback progress; ///< Called per sector, optional
+    void* context;
+    uint32_t completed; ///< Bytes done
+    uint32_t crc;
+    Result result;
+};
+
+/*
+ * The time spent at the head of the queue and the bytes done, per job type.
+ */
+struct Statistics
+{
+    uint32_t micros;
+    uint32_t bytes;
+};
+
+/*
+ * Returns false when the queue is full.
+ */
+bool Submit(Type type, uint32_t offset, uint32_t length, const uint8_t* buffer, Callback done, Callback progress = nullptr, void* context = nullptr);
+
+uint32_t Pending();
+
+inline bool IsIdle()
+{
+    return Pending() == 0;
+}
+
+/*
+ * Services the queue for a single time slice.
+ */
+void Run();
+
+/*
+ * Completes all the jobs, the watchdog is fed meanwhile.
+ * Only for callers that cannot continue before the flash is done.
+ */
+void Flush();
+
+const Statistics& GetStatistics(Type type);
+void ResetStatistics();
+} // namespace flashcode::jobs
+
+#endif // FLASHCODEJOBS_H_
@@ -0,0 +1,284 @@
+/**
+ * @file flashcodejobs.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <zlib.h>
+
+#include "flashcodejobs.h"
+#include "flashcode.h"
+#include "hal_micros.h"
+#include "hal_watchdog.h"
+#include "softwaretimers.h"
+#include "firmware/debug/debug_debug.h"
+
+namespace flashcode::jobs
+{
+static constexpr uint32_t kSliceMicros = 50;
+/* Verify and CRC read the flash in chunks */
+static constexpr uint32_t kChunkSize = 256;
+
+static Job s_jobs[kMaxJobs];
+static uint32_t s_head;
+static uint32_t s_count;
+static TimerHandle_t s_timer_id = kTimerIdNone;
+static uint8_t s_chunk[kChunkSize] __attribute__((aligned(4)));
+static Statistics s_statistics[static_cast<uint32_t>(Type::kCrc) + 1];
+static uint32_t s_head_micros; ///< Since the job at the head of the queue was started
+static bool s_is_writing;      ///< A sector is being programmed by Write, it must be completed by Write
+
+/*
+ * The timer stays registered once added, it must not be deleted from within its own callback.
+ * With the queue empty, Run returns straight away.
+ */
+static void Timer([[maybe_unused]] TimerHandle_t handle)
+{
+    Run();
+}
+
+/*
+ * Erase and program are done per sector, verify and CRC per chunk.
+ * Returns true when the job has finished.
+ */
+static bool Step(Job& job, bool is_blocking)
+{
+    auto* flash = FlashCode::Get();
+    assert(flash != nullptr);
+
+    const auto kSectorSize = flash->GetSectorSize();
+    const auto kRemaining = job.length - job.completed;
+
+    switch (job.type)
+    {
+        case Type::kErase:
+        {
+            const auto kLength = kRemaining < kSectorSize ? kRemaining : kSectorSize;
+
+            if (!flash->Erase(job.offset + job.completed, kLength, job.result))
+            {
+                return false;
+            }
+
+            job.completed += kLength;
+        }
+        break;
+        case Type::kProgram:
+        {
+            const auto kLength = kRemaining < kSectorSize ? kRemaining : kSectorSize;
+            const auto kOffset = job.offset + job.completed;
+            const auto* const kBuffer = &job.buffer[job.completed];
+
+            /*
+             * When nothing else can run, a page is programmed per call.
+             * A sector started by Run is completed word by word, WriteBulk would restart it
+             * while the flash is still programming, and program the words written already again.
+             */
+            const auto kIsBulk = is_blocking && !s_is_writing;
+            const auto kIsDone = kIsBulk ? flash->WriteBulk(kOffset, kLength, kBuffer, job.result) : flash->Write(kOffset, kLength, kBuffer, job.result);
+
+            s_is_writing = !kIsBulk && !kIsDone;
+
+            if (!kIsDone)
+            {
+                return false;
+            }
+
+            job.completed += kLength;
+        }
+        break;
+        case Type::kVerify:
+        case Type::kCrc:
+        {
+            const auto kLength = kRemaining < kChunkSize ? kRemaining : kChunkSize;
+
+            // The flash is read per word
+            flash->Read(job.offset + job.completed, (kLength + 3U) & ~3U, s_chunk, job.result);
+
+            if (flashcode::Result::kOk == job.result)
+            {
+                if (Type::kVerify == job.type)
+                {
+                    if (memcmp(s_chunk, &job.buffer[job.completed], kLength) != 0)
+                    {
+                        job.result = flashcode::Result::kError;
+                    }
+                }
+                else
+                {
+                    job.crc = crc32(job.crc, s_chunk, kLength);
+                }
+            }
+
+            job.completed += kLength;
+        }
+        break;
+        default:
+            assert(0);
+            __builtin_unreachable();
+            break;
+    }
+
+    if ((flashcode::Result::kError == job.result) || (job.completed == job.length))
+    {
+        return true;
+    }
+
+    if ((job.progress != nullptr) && ((job.completed % kSectorSize) == 0))
+    {
+        job.progress(job);
+    }
+
+    return false;
+}
+
+/*
+ * The job is removed from the queue before the callback, so the callback can submit new jobs.
+ */
+static void Finish()
+{
+    const auto kJob = s_jobs[s_head];
+
+    // An erase or program continues in the background, hence the time at the head of the queue
+    const auto kMicros = hal::Micros();
+    auto& statistics = s_statistics[static_cast<uint32_t>(kJob.type)];
+    statistics.micros += kMicros - s_head_micros;
+    statistics.bytes += kJob.completed;
+    s_head_micros = kMicros;
+
+    s_head = (s_head + 1) % kMaxJobs;
+    s_count--;
+
+    DEBUG_PRINTF("type=%d, offset=%x, length=%u, result=%d", static_cast<int>(kJob.type), static_cast<unsigned int>(kJob.offset), static_cast<unsigned int>(kJob.length), static_cast<int>(kJob.result));
+
+    if (flashcode::Result::kError == kJob.result)
+    {
+        printf("Error: flash job %d at %x\n", static_cast<int>(kJob.type), static_cast<unsigned int>(kJob.offset + kJob.completed));
+    }
+
+    if (kJob.done != nullptr)
+    {
+        kJob.done(kJob);
+    }
+}
+
+bool Submit(Type type, uint32_t offset, uint32_t length, const uint8_t* buffer, Callback done, Callback progress, void* context)
+{
+    DEBUG_PRINTF("type=%d, offset=%x, length=%u, s_count=%u", static_cast<int>(type), static_cast<unsigned int>(offset), static_cast<unsigned int>(length), static_cast<unsigned int>(s_count));
+
+    assert((type == Type::kErase) || (type == Type::kCrc) || (buffer != nullptr));
+
+    if (s_count == kMaxJobs)
+    {
+        return false;
+    }
+
+    if (s_count == 0)
+    {
+        s_head_micros = hal::Micros();
+    }
+
+    auto& job = s_jobs[(s_head + s_count) % kMaxJobs];
+
+    job.type = type;
+    job.offset = offset;
+    job.length = length;
+    job.buffer = buffer;
+    job.done = done;
+    job.progress = progress;
+    job.context = context;
+    job.completed = 0;
+    job.crc = 0;
+    job.result = flashcode::Result::kOk;
+
+    s_count++;
+
+    if (s_timer_id == kTimerIdNone)
+    {
+        s_timer_id = SoftwareTimerAdd(0, Timer);
+    }
+
+    return true;
+}
+
+uint32_t Pending()
+{
+    return s_count;
+}
+
+void Run()
+{
+    if (s_count == 0)
+    {
+        return;
+    }
+
+    const auto kStartMicros = hal::Micros();
+
+    while (s_count != 0)
+    {
+        auto& job = s_jobs[s_head];
+
+        if ((job.length == 0) || Step(job, false))
+        {
+            Finish();
+        }
+
+        if ((hal::Micros() - kStartMicros) >= kSliceMicros)
+        {
+            return;
+        }
+    }
+}
+
+void Flush()
+{
+    while (s_count != 0)
+    {
+        auto& job = s_jobs[s_head];
+
+        if ((job.length == 0) || Step(job, true))
+        {
+            Finish();
+        }
+
+        if (hal::Watchdog())
+        {
+            hal::WatchdogFeed();
+        }
+    }
+}
+
+const Statistics& GetStatistics(Type type)
+{
+    return s_statistics[static_cast<uint32_t>(type)];
+}
+
+void ResetStatistics()
+{
+    memset(s_statistics, 0, sizeof(s_statistics));
+}
+} // namespace flashcode::jobs
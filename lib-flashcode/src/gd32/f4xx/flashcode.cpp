@@ -41,6 +41,11 @@ uint32_t FlashCode::GetSectorSize() const
     return SIZE_16KB;
 }
 
+/*
+ * Not used, the CPU stalls while the flash is busy.
+ */
+void FlashCode::SetBusyHook([[maybe_unused]] flashcode::BusyHook hook) {}
+
 bool FlashCode::Read(uint32_t offset, uint32_t length, uint8_t* buffer, flashcode::Result& result)
 {
     DEBUG_ENTRY();
@@ -160,3 +165,8 @@ bool FlashCode::Erase(uint32_t offset, uint32_t length, flashcode::Result& resul
     DEBUG_EXIT();
     return true;
 }
+
+bool FlashCode::WriteBulk(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result)
+{
+    return Write(offset, length, buffer, result);
+}
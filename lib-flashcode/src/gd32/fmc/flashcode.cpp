@@ -59,6 +59,7 @@ enum class State
     ERASE_PROGAM,
     WRITE_BUSY,
     WRITE_PROGRAM,
+    WRITE_BULK,
     ERROR
 };
 
@@ -88,6 +89,100 @@ bool static is_bank0(const uint32_t page_address)
     return true;
 }
 
+namespace flashcode
+{
+static BusyHook s_busy_hook;
+} // namespace flashcode
+
+/*
+ * Instruction fetches from a bank that is busy erasing or programming stall the CPU.
+ * So the waiting for bank0, which holds the code, is done from RAM with the interrupts disabled,
+ * as the vector table and the handlers are in flash. Meanwhile the busy hook is called.
+ */
+RAMFUNC static void wait_ready(volatile uint32_t& stat)
+{
+    while ((stat & FMC_STAT0_BUSY) == FMC_STAT0_BUSY)
+    {
+        if (flashcode::s_busy_hook != nullptr)
+        {
+            flashcode::s_busy_hook();
+        }
+    }
+}
+
+RAMFUNC static void erase_page_bank0(uint32_t page)
+{
+    FMC_CTL0 |= FMC_CTL0_PER;
+    FMC_ADDR0 = page;
+    FMC_CTL0 |= FMC_CTL0_START;
+
+    wait_ready(FMC_STAT0);
+}
+
+/*
+ * The flash is programmed per word. A trailing part of a word is padded with 0xFF,
+ * the bytes beyond the end of the data are not read.
+ */
+RAMFUNC static uint32_t get_word(const uint32_t* data, uint32_t length)
+{
+    if (length >= 4)
+    {
+        return *data;
+    }
+
+    const auto* const kBytes = reinterpret_cast<const uint8_t*>(data);
+    uint32_t word = 0xFFFFFFFF;
+
+    for (auto i = length; i-- > 0;)
+    {
+        word = (word << 8) | kBytes[i];
+    }
+
+    return word;
+}
+
+/* FMC_CTL1_PG and the FMC_STAT1 flags have the same bit positions */
+RAMFUNC static bool program_words(volatile uint32_t& ctl, volatile uint32_t& stat, uint32_t address, const uint32_t* data, uint32_t length)
+{
+    stat = FMC_STAT0_ENDF | FMC_STAT0_WPERR | FMC_STAT0_PGERR;
+    ctl |= FMC_CTL0_PG;
+
+    while (length > 0)
+    {
+        REG32(address) = get_word(data++, length);
+
+        wait_ready(stat);
+
+        if ((stat & (FMC_STAT0_WPERR | FMC_STAT0_PGERR)) != 0)
+        {
+            ctl &= ~FMC_CTL0_PG;
+            return false;
+        }
+
+        address += 4;
+        length = length > 4 ? length - 4 : 0;
+    }
+
+    ctl &= ~FMC_CTL0_PG;
+    return true;
+}
+
+static bool program(bool is_bank0, uint32_t address, const uint32_t* data, uint32_t length)
+{
+    if (is_bank0)
+    {
+        const auto kPrimask = __get_PRIMASK();
+        __disable_irq();
+
+        const auto kIsOk = program_words(FMC_CTL0, FMC_STAT0, address, data, length);
+
+        __set_PRIMASK(kPrimask);
+        return kIsOk;
+    }
+
+    return program_words(FMC_CTL1, FMC_STAT1, address, data, length);
+}
+
 using namespace flashcode;
 
 uint32_t FlashCode::GetSize() const
@@ -100,6 +195,11 @@ uint32_t FlashCode::GetSectorSize() const
     return kFlashSectorSize;
 }
 
+void FlashCode::SetBusyHook(flashcode::BusyHook hook)
+{
+    s_busy_hook = hook;
+}
+
 bool FlashCode::Read(uint32_t offset, uint32_t length, uint8_t* pBuffer, flashcode::Result& result)
 {
     DEBUG_ENTRY();
@@ -198,9 +298,12 @@ bool FlashCode::Erase(uint32_t offset, uint32_t length, flashcode::Result& resul
 
                 if (s_isBank0)
                 {
-                    FMC_CTL0 |= FMC_CTL0_PER;
-                    FMC_ADDR0 = s_page;
-                    FMC_CTL0 |= FMC_CTL0_START;
+                    const auto kPrimask = __get_PRIMASK();
+                    __disable_irq();
+
+                    erase_page_bank0(s_page);
+
+                    __set_PRIMASK(kPrimask);
 
                     s_length -= kBanK0FlashPage;
                     s_page += kBanK0FlashPage;
@@ -236,6 +339,7 @@ bool FlashCode::Erase(uint32_t offset, uint32_t length, flashcode::Result& resul
             /*@fallthrough@*/
             /* no break */
         case State::WRITE_PROGRAM:
+        case State::WRITE_BULK:
             s_state = State::IDLE;
             DEBUG_EXIT();
             return false;
@@ -321,35 +425,134 @@ bool FlashCode::Write(uint32_t offset, uint32_t length, const uint8_t* pBuffer,
             return false;
             break;
         case State::WRITE_PROGRAM:
-            if (s_length >= 4)
+            if (s_isBank0)
             {
-                if (s_isBank0)
-                {
-                    FMC_CTL0 |= FMC_CTL0_PG;
-                }
-                else
+                const auto kLength = s_length < 4 ? s_length : 4;
+
+                if (!program(true, s_address, s_data, kLength))
                 {
-                    FMC_CTL1 |= FMC_CTL1_PG;
+                    fmc_bank0_lock();
+                    s_state = State::IDLE;
+                    result = Result::kError;
+                    return true;
                 }
-                REG32(s_address) = *s_data;
 
                 s_data++;
                 s_address += 4;
-                s_length -= 4;
+                s_length -= kLength;
+            }
+            else
+            {
+                const auto kLength = s_length < 4 ? s_length : 4;
+
+                FMC_CTL1 |= FMC_CTL1_PG;
+                REG32(s_address) = get_word(s_data, kLength);
+
+                s_data++;
+                s_address += 4;
+                s_length -= kLength;
             }
-            else if (s_length > 0)
+            s_state = State::WRITE_BUSY;
+            return false;
+            break;
+        case State::ERASE_BUSY:
+            if (s_isBank0)
+            {
+                FMC_CTL0 &= ~FMC_CTL0_PER;
+            }
+            else
+            {
+                FMC_CTL1 &= ~FMC_CTL1_PER;
+            }
+            /*@fallthrough@*/
+            /* no break */
+        case State::ERASE_PROGAM:
+        case State::WRITE_BULK:
+            s_state = State::IDLE;
+            DEBUG_EXIT();
+            return false;
+            break;
+        default:
+            assert(0);
+            __builtin_unreachable();
+            break;
+    }
+
+    assert(0);
+    __builtin_unreachable();
+    return true;
+}
+
+/**
+ * A complete flash page is programmed per call, returns false until done.
+ * Each word is polled for BUSY in a tight loop running from RAM.
+ */
+bool FlashCode::WriteBulk(uint32_t offset, uint32_t length, const uint8_t* pBuffer, flashcode::Result& result)
+{
+    result = Result::kOk;
+
+    switch (s_state)
+    {
+        case State::IDLE:
+            DEBUG_PUTS("State::IDLE");
+            s_address = offset + FLASH_BASE;
+            s_data = const_cast<uint32_t*>(reinterpret_cast<const uint32_t*>(pBuffer));
+            s_length = length;
+            if ((s_isBank0 = is_bank0(s_address)))
+            {
+                fmc_bank0_unlock();
+            }
+            else
+            {
+                fmc_bank1_unlock();
+            }
+            s_state = State::WRITE_BULK;
+            /*@fallthrough@*/
+            /* no break */
+        case State::WRITE_BULK:
+        {
+            const auto kPageSize = s_isBank0 ? kBanK0FlashPage : kBanK1FlashPage;
+            const auto kPageRemaining = kPageSize - (s_address & (kPageSize - 1));
+            const auto kLength = s_length < kPageRemaining ? s_length : kPageRemaining;
+            const auto kIsOk = program(s_isBank0, s_address, s_data, kLength);
+
+            s_address += kLength;
+            s_data += kLength / 4;
+            s_length -= kLength;
+
+            if (!kIsOk || (s_length == 0))
             {
                 if (s_isBank0)
                 {
-                    FMC_CTL0 |= FMC_CTL0_PG;
+                    fmc_bank0_lock();
                 }
                 else
                 {
-                    FMC_CTL1 |= FMC_CTL1_PG;
+                    fmc_bank1_lock();
                 }
-                REG32(s_address) = *s_data;
+                s_state = State::IDLE;
+                result = kIsOk ? Result::kOk : Result::kError;
+                DEBUG_EXIT();
+                return true;
             }
-            s_state = State::WRITE_BUSY;
+
+            return false;
+        }
+        break;
+        case State::WRITE_BUSY:
+            if (s_isBank0)
+            {
+                FMC_CTL0 &= ~FMC_CTL0_PG;
+            }
+            else
+            {
+                FMC_CTL1 &= ~FMC_CTL1_PG;
+            }
+            /*@fallthrough@*/
+            /* no break */
+        case State::WRITE_PROGRAM:
+            s_state = State::IDLE;
+            DEBUG_EXIT();
             return false;
             break;
         case State::ERASE_BUSY:
@@ -66,6 +66,11 @@ uint32_t FlashCode::GetSectorSize() const
     return kFlashSectorSize;
 }
 
+/*
+ * Not used, the CPU stalls while the flash is busy.
+ */
+void FlashCode::SetBusyHook([[maybe_unused]] flashcode::BusyHook hook) {}
+
 bool FlashCode::Read(uint32_t offset, uint32_t length, uint8_t* buffer, Result& result)
 {
     DEBUG_ENTRY();
@@ -235,3 +240,8 @@ bool FlashCode::Write(uint32_t offset, uint32_t length, const uint8_t* buffer, f
     __builtin_unreachable();
     return true;
 }
+
+bool FlashCode::WriteBulk(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result)
+{
+    return Write(offset, length, buffer, result);
+}
@@ -107,3 +107,8 @@ bool FlashCode::Write(uint32_t offset, uint32_t length, const uint8_t* buffer, f
     DEBUG_EXIT();
     return true;
 }
+
+bool FlashCode::WriteBulk(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result)
+{
+    return Write(offset, length, buffer, result);
+}
@@ -0,0 +1,285 @@
+/**
+ * @file test_jobs.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host test of the flash job queue, against a flash in RAM with the state machines of the GD32 FMC driver.
+ * Write programs a word per call. WriteBulk programs a page per call, and called while a Write
+ * is in progress it resets the state machine, as the driver does.
+ * A word that is not erased cannot be programmed, the FMC reports PGERR.
+ *
+ * cd lib-flashcode/test
+ * g++ -std=c++20 -Wall -Wextra -Werror -DNDEBUG -I. -I../include -I../../include -I../../lib-hal/include -I../../common/include \
+ *     test_jobs.cpp ../src/flashcodejobs.cpp ../../lib-clib/src/crc32/crc32.cpp -o test_jobs && ./test_jobs
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "flashcode.h"
+#include "flashcodejobs.h"
+#include "hal_micros.h"
+#include "softwaretimers.h"
+
+namespace test
+{
+static constexpr uint32_t kFlashSize = 64 * 1024;
+static constexpr uint32_t kSectorSize = 4096;
+static constexpr uint32_t kPageSize = 2048;
+static uint8_t s_flash[kFlashSize] __attribute__((aligned(4)));
+
+enum class State
+{
+    kIdle,
+    kWrite,
+    kWriteBulk
+};
+
+static State s_state;
+static uint32_t s_address;
+static uint32_t s_length;
+static const uint8_t* s_data;
+static uint32_t s_micros;
+static uint32_t s_write_calls;
+static uint32_t s_bulk_calls;
+
+static bool Program(uint32_t address, const uint8_t* data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i += 4)
+    {
+        uint32_t word;
+        memcpy(&word, &s_flash[address + i], 4);
+
+        if (word != 0xFFFFFFFF)
+        {
+            printf("PGERR at %x\n", static_cast<unsigned int>(address + i));
+            return false;
+        }
+
+        memcpy(&s_flash[address + i], &data[i], (length - i) < 4 ? (length - i) : 4);
+    }
+
+    return true;
+}
+} // namespace test
+
+uint32_t hal::Micros()
+{
+    test::s_micros += 10;
+    return test::s_micros;
+}
+
+TimerHandle_t SoftwareTimerAdd([[maybe_unused]] uint32_t interval_millis, [[maybe_unused]] const TimerCallbackFunction_t callback)
+{
+    return 0;
+}
+
+FlashCode::FlashCode()
+{
+    detected_ = true;
+    s_this = this;
+}
+
+FlashCode::~FlashCode()
+{
+    s_this = nullptr;
+}
+
+const char* FlashCode::GetName() const
+{
+    return "RAM";
+}
+
+uint32_t FlashCode::GetSize() const
+{
+    return test::kFlashSize;
+}
+
+uint32_t FlashCode::GetSectorSize() const
+{
+    return test::kSectorSize;
+}
+
+bool FlashCode::Read(uint32_t offset, uint32_t length, uint8_t* buffer, flashcode::Result& result)
+{
+    memcpy(buffer, &test::s_flash[offset], length);
+    result = flashcode::Result::kOk;
+    return true;
+}
+
+bool FlashCode::Erase(uint32_t offset, uint32_t length, flashcode::Result& result)
+{
+    memset(&test::s_flash[offset], 0xFF, length);
+    result = flashcode::Result::kOk;
+    return true;
+}
+
+bool FlashCode::Write(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result)
+{
+    result = flashcode::Result::kOk;
+    test::s_write_calls++;
+
+    if (test::s_state != test::State::kWrite)
+    {
+        test::s_address = offset;
+        test::s_length = length;
+        test::s_data = buffer;
+        test::s_state = test::State::kWrite;
+        return false;
+    }
+
+    const auto kLength = test::s_length < 4 ? test::s_length : 4;
+
+    if (!test::Program(test::s_address, test::s_data, kLength))
+    {
+        test::s_state = test::State::kIdle;
+        result = flashcode::Result::kError;
+        return true;
+    }
+
+    test::s_address += kLength;
+    test::s_data += kLength;
+    test::s_length -= kLength;
+
+    if (test::s_length == 0)
+    {
+        test::s_state = test::State::kIdle;
+        return true;
+    }
+
+    return false;
+}
+
+bool FlashCode::WriteBulk(uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::Result& result)
+{
+    result = flashcode::Result::kOk;
+    test::s_bulk_calls++;
+
+    if (test::s_state == test::State::kWrite)
+    {
+        test::s_state = test::State::kIdle;
+        return false;
+    }
+
+    if (test::s_state == test::State::kIdle)
+    {
+        test::s_address = offset;
+        test::s_length = length;
+        test::s_data = buffer;
+        test::s_state = test::State::kWriteBulk;
+    }
+
+    const auto kPageRemaining = test::kPageSize - (test::s_address & (test::kPageSize - 1));
+    const auto kLength = test::s_length < kPageRemaining ? test::s_length : kPageRemaining;
+    const auto kIsOk = test::Program(test::s_address, test::s_data, kLength);
+
+    test::s_address += kLength;
+    test::s_data += kLength;
+    test::s_length -= kLength;
+
+    if (!kIsOk || (test::s_length == 0))
+    {
+        test::s_state = test::State::kIdle;
+        result = kIsOk ? flashcode::Result::kOk : flashcode::Result::kError;
+        return true;
+    }
+
+    return false;
+}
+
+namespace test
+{
+static constexpr uint32_t kImageSize = 2 * kSectorSize + 100;
+static uint8_t s_image[kImageSize];
+static uint32_t s_done;
+static flashcode::Result s_result;
+
+static void Done(const flashcode::jobs::Job& job)
+{
+    s_done++;
+    s_result = job.result;
+}
+
+static int s_failed;
+
+static void Check(bool condition, const char* text)
+{
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", text);
+
+    if (!condition)
+    {
+        s_failed++;
+    }
+}
+
+static void Reset()
+{
+    memset(s_flash, 0, sizeof(s_flash));
+    s_done = 0;
+    s_result = flashcode::Result::kError;
+    s_write_calls = 0;
+    s_bulk_calls = 0;
+}
+} // namespace test
+
+int main()
+{
+    FlashCode flash;
+
+    for (uint32_t i = 0; i < test::kImageSize; i++)
+    {
+        test::s_image[i] = static_cast<uint8_t>(i * 13 + 5);
+    }
+
+    // Flush only, the sectors are programmed a page per call
+    test::Reset();
+    flashcode::jobs::Submit(flashcode::jobs::Type::kErase, 0, 3 * test::kSectorSize, nullptr, nullptr);
+    flashcode::jobs::Submit(flashcode::jobs::Type::kProgram, 0, test::kImageSize, test::s_image, test::Done);
+    flashcode::jobs::Flush();
+
+    test::Check((test::s_done == 1) && (test::s_result == flashcode::Result::kOk), "Flush: program job done");
+    test::Check(memcmp(test::s_flash, test::s_image, test::kImageSize) == 0, "Flush: flash content");
+    test::Check((test::s_bulk_calls != 0) && (test::s_write_calls == 0), "Flush: WriteBulk only");
+
+    // Run starts the program job word by word, Flush completes the same job
+    test::Reset();
+    flashcode::jobs::Submit(flashcode::jobs::Type::kErase, 0, 3 * test::kSectorSize, nullptr, nullptr);
+    flashcode::jobs::Submit(flashcode::jobs::Type::kProgram, 0, test::kImageSize, test::s_image, test::Done);
+
+    while (test::s_write_calls < 8)
+    {
+        flashcode::jobs::Run();
+    }
+
+    test::Check(flashcode::jobs::Pending() == 1, "Run: program job in progress");
+
+    flashcode::jobs::Flush();
+
+    test::Check((test::s_done == 1) && (test::s_result == flashcode::Result::kOk), "Run and Flush: program job done");
+    test::Check(memcmp(test::s_flash, test::s_image, test::kImageSize) == 0, "Run and Flush: flash content");
+    test::Check(test::s_bulk_calls != 0, "Run and Flush: the next sectors with WriteBulk");
+
+    return test::s_failed == 0 ? 0 : 1;
+}
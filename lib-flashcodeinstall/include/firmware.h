@@ -69,18 +69,23 @@ static constexpr auto FILE_NAME_LENGTH = sizeof(FILE_NAME) - 1;
 # if defined (BOARD_GD32F107RC)
 #  define OFFSET_UIMAGE		0x007000		// 28K
 #  define FIRMWARE_MAX_SIZE (76 * 1024)		// 76K
+#  define OFFSET_SLOT_B		0x01A000		// 104K
 # elif defined (BOARD_GD32F207RG)
 #  define OFFSET_UIMAGE		0x008000		// 32K
 #  define FIRMWARE_MAX_SIZE (234 * 1024)	// 234K
+#  define OFFSET_SLOT_B		0x080000		// 512K, bank1
 # elif defined (BOARD_GD32F207VC_2)
 #  define OFFSET_UIMAGE		0x008000		// 32K
 #  define FIRMWARE_MAX_SIZE (106 * 1024)	// 106K
+#  define OFFSET_SLOT_B		0x023000		// 140K
 # elif defined (BOARD_GD32F207VC_4)
 #  define OFFSET_UIMAGE		0x008000		// 32K
 #  define FIRMWARE_MAX_SIZE (106 * 1024)	// 106K
+#  define OFFSET_SLOT_B		0x023000		// 140K
 # elif defined (BOARD_GD32F207C_EVAL)
 #  define OFFSET_UIMAGE		0x008000		// 32K
 #  define FIRMWARE_MAX_SIZE (106 * 1024)	// 106K
+#  define OFFSET_SLOT_B		0x023000		// 140K
 # elif defined (BOARD_GD32F407RE)
 #  define OFFSET_UIMAGE		0x008000		// 32K
 #  define FIRMWARE_MAX_SIZE (116 * 1024)	// 116K
@@ -0,0 +1,153 @@
+/**
+ * @file firmwarepatch.h
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FIRMWAREPATCH_H_
+#define FIRMWAREPATCH_H_
+
+#include <cstdint>
+
+/*
+ * Delta firmware, built by common/scripts/gd32/make-patch.py.
+ * The new image is described as the installed image, with bsdiff style operations:
+ *
+ *   kCopy   <length>           old bytes at the old position
+ *   kAdd    <length> <bytes>   old bytes at the old position plus the bytes, per byte
+ *   kInsert <length> <bytes>   new bytes
+ *   kSeek   <distance>         moves the old position, zigzag encoded
+ *   kEnd
+ *
+ * The operation is in the upper 3 bits of the first byte, the length or distance in the lower 5 bits.
+ * From 31 onwards, the remainder follows as a LEB128 varint. Copy and add move the old position along.
+ * The new image carries its own trailer, so it is checked as any other image.
+ */
+namespace firmware::patch
+{
+static constexpr uint32_t kMagic = 0x50445746; ///< "FWDP"
+static constexpr uint32_t kOpShift = 5;
+static constexpr uint32_t kLengthMax = 31;
+
+/*
+ * The old image is not read from a sector that has been written already,
+ * so the patch can be installed over the old image.
+ */
+static constexpr uint32_t kFlagInPlace = 0x1;
+
+struct Header
+{
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t old_size; ///< Of the installed image, including the trailer
+    uint32_t old_crc;  ///< The crc of the trailer of the installed image
+    uint32_t new_size; ///< Including the trailer
+};
+
+static_assert(sizeof(struct Header) == 20);
+
+enum class Op : uint8_t
+{
+    kEnd,
+    kCopy,
+    kAdd,
+    kInsert,
+    kSeek
+};
+
+/*
+ * Returns false when the header does not match the installed image.
+ */
+typedef bool (*Check)(const Header& header);
+
+/*
+ * Reads the installed image, returns false when the offset can no longer be read.
+ */
+typedef bool (*Source)(uint32_t offset, uint8_t& c);
+
+/*
+ * Returns false when the output cannot be written.
+ */
+typedef bool (*Put)(uint8_t c);
+
+inline bool IsPatch(const uint8_t* data, uint32_t length)
+{
+    return (length >= 4) && ((static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24) == kMagic);
+}
+
+/*
+ * The patch is applied byte by byte while it arrives, the input can be split anywhere.
+ */
+class Decoder
+{
+    enum class State
+    {
+        kHeader,
+        kOp,
+        kLength,
+        kAdd,
+        kInsert,
+        kDone,
+        kError
+    };
+
+   public:
+    Decoder(Check check, Source source, Put put) : check_(check), source_(source), put_(put) {}
+
+    void Reset()
+    {
+        state_ = State::kHeader;
+        count_ = 0;
+        position_ = 0;
+        size_ = 0;
+    }
+
+    /*
+     * Returns false on a malformed patch, a patch for another image, or when the output cannot be written.
+     * Data after the end of the patch is ignored.
+     */
+    bool Update(const uint8_t* data, uint32_t length);
+
+    /*
+     * The end was reached, and the new image is complete.
+     */
+    bool IsDone() const { return state_ == State::kDone; }
+
+   private:
+    bool Output(uint8_t c);
+    bool Apply();
+
+   private:
+    Check check_;
+    Source source_;
+    Put put_;
+    State state_{State::kHeader};
+    Header header_;
+    Op op_{Op::kEnd};
+    uint32_t count_{0};
+    uint32_t value_{0};
+    uint32_t position_{0}; ///< In the installed image
+    uint32_t size_{0};     ///< Of the new image, so far
+};
+} // namespace firmware::patch
+
+#endif // FIRMWAREPATCH_H_
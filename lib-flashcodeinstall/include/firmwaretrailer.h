@@ -0,0 +1,128 @@
+/**
+ * @file firmwaretrailer.h
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FIRMWARETRAILER_H_
+#define FIRMWARETRAILER_H_
+
+#include <cstdint>
+
+/*
+ * The firmware image is followed by a trailer, appended by common/scripts/gd32/add-trailer.sh.
+ * The image is padded with 0xFF to a whole number of words, so the trailer is word aligned.
+ *
+ * The crc32 covers the image, the magic and the length. The crc32 of the image including
+ * the complete trailer is therefore the CRC-32 residue, which can be checked without
+ * knowing in advance where the image ends.
+ */
+namespace firmware::trailer
+{
+static constexpr uint32_t kMagic = 0x52545746; ///< "FWTR"
+static constexpr uint32_t kResidue = 0x2144DF1C;
+
+struct Trailer
+{
+    uint32_t magic;
+    uint32_t length; ///< Of the image, without the trailer
+    uint32_t crc;
+};
+
+static_assert(sizeof(struct Trailer) == 12);
+
+/*
+ * The crc32 is computed while the blocks arrive, in order.
+ */
+class Check
+{
+   public:
+    void Reset()
+    {
+        crc_ = 0;
+        size_ = 0;
+    }
+
+    void Update(const uint8_t* data, uint32_t length);
+
+    /*
+     * Returns true when the data received ends with a trailer that matches.
+     */
+    bool IsValid() const;
+
+    /*
+     * The image including the trailer
+     */
+    uint32_t GetSize() const { return size_; }
+
+   private:
+    uint32_t crc_{0};
+    uint32_t size_{0};
+    uint8_t tail_[sizeof(struct Trailer)];
+};
+
+enum class Status
+{
+    kMissing, ///< No trailer found, an image from before the trailer was introduced
+    kValid,
+    kInvalid
+};
+
+/*
+ * Returns the size of an image in memory-mapped flash, including the trailer.
+ * Returns 0 when no trailer is found.
+ */
+uint32_t GetSize(const uint8_t* image, uint32_t max_size);
+
+/*
+ * Checks an image in memory-mapped flash.
+ */
+Status Verify(const uint8_t* image, uint32_t max_size);
+
+/*
+ * The boot record is written in the last bytes of the firmware area, once the installed image
+ * has been verified. At boot, the record is checked against the trailer and a sample of the
+ * image, instead of computing the crc32 of the whole image.
+ */
+static constexpr uint32_t kVerified = 0x44465256; ///< "VRFD"
+static constexpr uint32_t kSampleSize = 2048;      ///< The vector table and the startup code
+
+struct Record
+{
+    uint32_t stamp;      ///< kVerified
+    uint32_t length;     ///< Of the image, without the trailer
+    uint32_t crc;        ///< Copy of the crc of the trailer
+    uint32_t sample_crc; ///< crc32 of the first kSampleSize bytes
+};
+
+static_assert(sizeof(struct Record) == 16);
+
+/*
+ * The record is only written when the image and the trailer leave room for it.
+ * Returns false otherwise.
+ */
+bool MakeRecord(const uint8_t* image, uint32_t size, uint32_t max_size, Record& record);
+
+bool IsVerified(const uint8_t* image, uint32_t max_size);
+} // namespace firmware::trailer
+
+#endif // FIRMWARETRAILER_H_
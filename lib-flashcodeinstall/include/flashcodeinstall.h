@@ -30,7 +30,12 @@
 #include <cstdio>
 
 #include "flashcode.h"
+#include "flashcodejobs.h"
 #include "firmware.h" //TODO Remove
+#if defined (GD32)
+# include "lz4decoder.h"
+# include "firmwarepatch.h"
+#endif
 
 class FlashCodeInstall: FlashCode {
 public:
@@ -39,6 +44,51 @@ public:
 
 	bool WriteFirmware(const uint8_t *buffer, uint32_t size);
 
+	/*
+	 * The size of the firmware is known before the data arrives.
+	 * Returns false when the firmware does not fit in the flash.
+	 * Otherwise the sectors needed are erased in the background.
+	 */
+	bool Prepare(uint32_t size);
+
+	/*
+	 * Streaming install, the firmware is programmed while it arrives.
+	 * Only a double buffer is used, instead of staging the whole firmware in RAM.
+	 * On GD32, an LZ4 frame is decompressed on the way into the double buffer,
+	 * and a patch is applied against the installed firmware.
+	 * With CONFIG_FLASHCODEINSTALL_SPI_STAGING, the file is staged in the SPI flash first.
+	 * It is installed by StreamEnd, once the staged copy has been verified.
+	 */
+	void StreamBegin();
+	bool StreamWrite(const uint8_t *data, uint32_t length);
+	bool StreamEnd();
+
+	/*
+	 * The size of the firmware written by the last stream, after decompression,
+	 * or by WriteFirmware.
+	 */
+	uint32_t GetImageSize() const {
+		return image_size_;
+	}
+
+	/*
+	 * Read-back of the installed firmware, including the trailer.
+	 * Returns true when the crc32 of the flash content is the CRC-32 residue.
+	 */
+	bool VerifyImage(uint32_t size);
+
+	/*
+	 * Erases the first sector, so the bootloader does not start the firmware.
+	 */
+	void Invalidate();
+
+	/*
+	 * With two slots, the firmware is installed in slot B while slot A keeps running.
+	 * At the next boot the bootloader copies a verified slot B into slot A.
+	 * Returns false when there is nothing to activate, or the copy failed.
+	 */
+	bool ActivateSlot();
+
 	static FlashCodeInstall* Get() {
 		return s_this;
 	}
@@ -50,15 +100,66 @@ private:
 	bool Diff(uint32_t offset);
 	void Write(uint32_t offset);
 	void Process(const char *file_name, uint32_t offset);
+	uint32_t GetEraseSize(uint32_t size) const;
+	bool IsSectorEqual(uint32_t offset, const uint8_t *data, uint32_t length) const;
+	void StreamReset();
+	bool StreamCommit();
+#if defined (CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+	bool StageProbe();
+	void StageBegin();
+	bool StageWrite(const uint8_t *data, uint32_t length);
+	bool StageFlush();
+	bool StageEnd();
+#endif
+	void ClearBootRecord(uint32_t offset);
+	void WriteBootRecord(uint32_t offset, uint32_t size);
+	bool CheckCrc(uint32_t offset, uint32_t size);
+	void Submit(flashcode::jobs::Type type, uint32_t offset, uint32_t length, const uint8_t *buffer, flashcode::jobs::Callback done, flashcode::jobs::Callback progress = nullptr);
+
+	static void EraseDone(const flashcode::jobs::Job &job);
+	static void ProgramDone(const flashcode::jobs::Job &job);
+	static void JobDone(const flashcode::jobs::Job &job);
+	static void CrcDone(const flashcode::jobs::Job &job);
+	static void Progress(const flashcode::jobs::Job &job);
+#if defined (GD32)
+	static bool DecoderPut(uint8_t c);
+	static uint8_t DecoderPeek(uint32_t distance);
+	static bool PatchCheck(const firmware::patch::Header &header);
+	static bool PatchSource(uint32_t offset, uint8_t &c);
+#endif
 
 private:
  uint32_t erase_size_{0};
+ uint32_t erased_size_{0};
  uint32_t flash_size_{0};
+ uint32_t image_offset_{OFFSET_UIMAGE}; ///< The slot being installed
  uint8_t* file_buffer_{nullptr};
  uint8_t* flash_buffer_{nullptr};
  FILE* file_{nullptr};
 
+ uint32_t stream_offset_{0};
+ uint32_t stream_length_{0};
+ uint32_t stream_index_{0};
+ uint32_t image_size_{0};
+ const uint8_t* stream_previous_{nullptr}; ///< The sector before stream_offset_, while it is programmed
+ uint32_t sectors_written_{0};
+ uint32_t sectors_skipped_{0};
+
  bool have_flash_{false};
+ bool is_error_{false};
+ bool is_programming_{false};
+#if defined (CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+ uint32_t stage_offset_{0};
+ uint32_t stage_length_{0};
+ bool have_staging_{false};
+ bool is_staging_{false}; ///< The internal flash has not been touched
+#endif
+#if defined (GD32)
+ bool is_compressed_{false};
+ bool is_patch_{false};
+ firmware::lz4::Decoder decoder_{DecoderPut, DecoderPeek};
+ firmware::patch::Decoder patch_{PatchCheck, PatchSource, DecoderPut};
+#endif
 
  inline static FlashCodeInstall* s_this;
 };
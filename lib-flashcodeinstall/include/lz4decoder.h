@@ -0,0 +1,118 @@
+/**
+ * @file lz4decoder.h
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LZ4DECODER_H_
+#define LZ4DECODER_H_
+
+#include <cstdint>
+
+/*
+ * Streaming decoder for the LZ4 frame format, the input is taken in pieces of any size.
+ * There is no window buffer, a match is copied from the output already written, which
+ * the sink reads back through Peek. The checksums of the frame are skipped, the image
+ * is checked with the firmware trailer.
+ */
+namespace firmware::lz4
+{
+static constexpr uint32_t kMagic = 0x184D2204;
+
+/*
+ * Returns false when the output cannot be written.
+ */
+typedef bool (*Put)(uint8_t c);
+
+/*
+ * Returns the output byte at distance back, where 1 is the last byte written.
+ */
+typedef uint8_t (*Peek)(uint32_t distance);
+
+inline bool IsFrame(const uint8_t* data, uint32_t length)
+{
+    return (length >= 4) && ((static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24) == kMagic);
+}
+
+class Decoder
+{
+    enum class State
+    {
+        kHeader,
+        kBlockSize,
+        kBlockRaw,
+        kToken,
+        kLiteralLength,
+        kLiterals,
+        kOffset,
+        kMatchLength,
+        kBlockChecksum,
+        kContentChecksum,
+        kDone,
+        kError
+    };
+
+   public:
+    Decoder(Put put, Peek peek) : put_(put), peek_(peek) {}
+
+    void Reset()
+    {
+        state_ = State::kHeader;
+        count_ = 0;
+        size_ = 0;
+    }
+
+    /*
+     * Returns false on a malformed frame, or when the output cannot be written.
+     * Data after the end of the frame is ignored.
+     */
+    bool Update(const uint8_t* data, uint32_t length);
+
+    bool IsDone() const { return state_ == State::kDone; }
+
+    /*
+     * The number of bytes decompressed
+     */
+    uint32_t GetSize() const { return size_; }
+
+   private:
+    bool Output(uint8_t c);
+    void AfterLiterals();
+    void EndBlock();
+    bool Copy();
+
+   private:
+    Put put_;
+    Peek peek_;
+    State state_{State::kHeader};
+    uint8_t flags_{0};
+    uint32_t header_size_{0};
+    uint32_t count_{0};
+    uint32_t value_{0};
+    uint32_t block_remaining_{0};
+    uint32_t literal_length_{0};
+    uint32_t match_length_{0};
+    uint32_t size_{0};
+};
+} // namespace firmware::lz4
+
+#endif // LZ4DECODER_H_
@@ -0,0 +1,79 @@
+/**
+ * @file updatestatistics.h
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef UPDATESTATISTICS_H_
+#define UPDATESTATISTICS_H_
+
+#include <cstdint>
+
+/*
+ * Where the time of the last firmware update went: the transfer, and the flash jobs per type.
+ * The results are kept in RAM until the next update, and can be queried with ?update#
+ */
+namespace firmware::update
+{
+struct Statistics
+{
+    uint32_t file_size;       ///< Received
+    uint32_t image_size;      ///< Installed, after decompression or patching
+    uint32_t transfer_millis; ///< From the request to the last block
+    uint32_t total_millis;    ///< The transfer and the install, a buffered file waits in between
+    uint32_t retransmits;
+    uint32_t out_of_order;
+    uint32_t erase_millis;
+    uint32_t program_millis;
+    uint32_t verify_millis; ///< Compare and CRC read-back
+    uint32_t erased_size;
+    uint32_t sectors_written;
+    uint32_t sectors_skipped;
+    bool is_done;
+    bool is_ok;
+};
+
+/*
+ * At the request, the statistics of the flash jobs start again.
+ */
+void Begin();
+void TransferEnd(uint32_t file_size, uint32_t retransmits, uint32_t out_of_order);
+/*
+ * A buffered file is installed when the TFTP server is switched off.
+ */
+void InstallBegin();
+void SetSectors(uint32_t written, uint32_t skipped);
+/*
+ * Collects the flash statistics and prints the results.
+ */
+void End(bool is_ok, uint32_t image_size);
+
+const Statistics& Get();
+
+/*
+ * A single line, for the remote configuration.
+ * Returns the length, without the terminating null.
+ */
+uint32_t Format(char* buffer, uint32_t size);
+} // namespace firmware::update
+
+#endif // UPDATESTATISTICS_H_
@@ -0,0 +1,199 @@
+/**
+ * @file firmwarepatch.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+
+#include "firmwarepatch.h"
+#include "firmware/debug/debug_debug.h"
+
+namespace firmware::patch
+{
+bool Decoder::Output(uint8_t c)
+{
+    if ((size_ == header_.new_size) || !put_(c))
+    {
+        state_ = State::kError;
+        return false;
+    }
+
+    size_++;
+    return true;
+}
+
+/*
+ * Called when the length of an operation is complete.
+ */
+bool Decoder::Apply()
+{
+    switch (op_)
+    {
+        case Op::kCopy:
+            for (; value_ != 0; value_--)
+            {
+                uint8_t c;
+
+                if ((position_ >= header_.old_size) || !source_(position_, c) || !Output(c))
+                {
+                    DEBUG_PRINTF("position_=%u, size_=%u", position_, size_);
+                    state_ = State::kError;
+                    return false;
+                }
+
+                position_++;
+            }
+
+            state_ = State::kOp;
+            break;
+        case Op::kAdd:
+            state_ = (value_ != 0) ? State::kAdd : State::kOp;
+            break;
+        case Op::kInsert:
+            state_ = (value_ != 0) ? State::kInsert : State::kOp;
+            break;
+        case Op::kSeek:
+            // Zigzag, modulo 2^32
+            position_ += ((value_ & 0x1) != 0) ? ~(value_ >> 1) : (value_ >> 1);
+            state_ = State::kOp;
+            break;
+        default:
+            state_ = State::kError;
+            return false;
+            break;
+    }
+
+    return true;
+}
+
+bool Decoder::Update(const uint8_t* data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        const auto kByte = data[i];
+
+        switch (state_)
+        {
+            case State::kHeader:
+                reinterpret_cast<uint8_t*>(&header_)[count_] = kByte;
+
+                if (++count_ == sizeof(struct Header))
+                {
+                    if ((header_.magic != kMagic) || !check_(header_))
+                    {
+                        state_ = State::kError;
+                        break;
+                    }
+
+                    state_ = State::kOp;
+                }
+                break;
+            case State::kOp:
+                op_ = static_cast<Op>(kByte >> kOpShift);
+                value_ = kByte & kLengthMax;
+
+                if (Op::kEnd == op_)
+                {
+                    state_ = (size_ == header_.new_size) ? State::kDone : State::kError;
+                    break;
+                }
+
+                if (op_ > Op::kSeek)
+                {
+                    state_ = State::kError;
+                    break;
+                }
+
+                if (value_ == kLengthMax)
+                {
+                    state_ = State::kLength;
+                    count_ = 0;
+                    break;
+                }
+
+                Apply();
+                break;
+            case State::kLength:
+                // At most 5 bytes for 32 bits
+                if (count_ == 5)
+                {
+                    state_ = State::kError;
+                    break;
+                }
+
+                value_ += static_cast<uint32_t>(kByte & 0x7F) << (7 * count_++);
+
+                if ((kByte & 0x80) == 0)
+                {
+                    Apply();
+                }
+                break;
+            case State::kAdd:
+            {
+                uint8_t c;
+
+                if ((position_ >= header_.old_size) || !source_(position_, c))
+                {
+                    DEBUG_PRINTF("position_=%u, size_=%u", position_, size_);
+                    state_ = State::kError;
+                    break;
+                }
+
+                if (!Output(static_cast<uint8_t>(c + kByte)))
+                {
+                    break;
+                }
+
+                position_++;
+
+                if (--value_ == 0)
+                {
+                    state_ = State::kOp;
+                }
+            }
+            break;
+            case State::kInsert:
+                if (!Output(kByte))
+                {
+                    break;
+                }
+
+                if (--value_ == 0)
+                {
+                    state_ = State::kOp;
+                }
+                break;
+            case State::kDone:
+                return true;
+                break;
+            case State::kError:
+                return false;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return state_ != State::kError;
+}
+} // namespace firmware::patch
@@ -0,0 +1,135 @@
+/**
+ * @file firmwaretrailer.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+#include "firmwaretrailer.h"
+
+namespace firmware::trailer
+{
+void Check::Update(const uint8_t* data, uint32_t length)
+{
+    crc_ = crc32(crc_, data, length);
+    size_ += length;
+
+    // Keep the last bytes received, as these are the trailer when the image is complete
+    if (length >= sizeof(tail_))
+    {
+        memcpy(tail_, &data[length - sizeof(tail_)], sizeof(tail_));
+        return;
+    }
+
+    memmove(tail_, &tail_[length], sizeof(tail_) - length);
+    memcpy(&tail_[sizeof(tail_) - length], data, length);
+}
+
+bool Check::IsValid() const
+{
+    if ((size_ < sizeof(tail_)) || (crc_ != kResidue))
+    {
+        return false;
+    }
+
+    Trailer trailer;
+    memcpy(&trailer, tail_, sizeof(tail_));
+
+    return (trailer.magic == kMagic) && (trailer.length == (size_ - sizeof(tail_)));
+}
+
+/*
+ * The trailer is searched from the start of the image, as a shorter image can be followed by
+ * parts of the previous one. The magic must be followed by its own offset.
+ */
+uint32_t GetSize(const uint8_t* image, uint32_t max_size)
+{
+    const auto* const kWords = reinterpret_cast<const uint32_t*>(image);
+    const auto kWordsTrailer = static_cast<uint32_t>(sizeof(struct Trailer) / 4);
+
+    for (uint32_t i = 0; (i + kWordsTrailer) <= (max_size / 4); i++)
+    {
+        if ((kWords[i] == kMagic) && (kWords[i + 1] == (i * 4)))
+        {
+            return i * 4 + static_cast<uint32_t>(sizeof(struct Trailer));
+        }
+    }
+
+    return 0;
+}
+
+Status Verify(const uint8_t* image, uint32_t max_size)
+{
+    const auto kSize = GetSize(image, max_size);
+
+    if (kSize == 0)
+    {
+        return Status::kMissing;
+    }
+
+    return (crc32(0, image, kSize) == kResidue) ? Status::kValid : Status::kInvalid;
+}
+
+bool MakeRecord(const uint8_t* image, uint32_t size, uint32_t max_size, Record& record)
+{
+    if ((size < sizeof(struct Trailer)) || ((size + sizeof(struct Record)) > max_size))
+    {
+        return false;
+    }
+
+    const auto kLength = size - static_cast<uint32_t>(sizeof(struct Trailer));
+
+    Trailer trailer;
+    memcpy(&trailer, &image[kLength], sizeof(struct Trailer));
+
+    record.stamp = kVerified;
+    record.length = kLength;
+    record.crc = trailer.crc;
+    record.sample_crc = crc32(0, image, kLength < kSampleSize ? kLength : kSampleSize);
+
+    return true;
+}
+
+bool IsVerified(const uint8_t* image, uint32_t max_size)
+{
+    Record record;
+    memcpy(&record, &image[max_size - sizeof(struct Record)], sizeof(struct Record));
+
+    if ((record.stamp != kVerified) || ((record.length & 0x3) != 0) || ((record.length + sizeof(struct Trailer) + sizeof(struct Record)) > max_size))
+    {
+        return false;
+    }
+
+    Trailer trailer;
+    memcpy(&trailer, &image[record.length], sizeof(struct Trailer));
+
+    if ((trailer.magic != kMagic) || (trailer.length != record.length) || (trailer.crc != record.crc))
+    {
+        return false;
+    }
+
+    return crc32(0, image, record.length < kSampleSize ? record.length : kSampleSize) == record.sample_crc;
+}
+} // namespace firmware::trailer
@@ -22,15 +22,735 @@
  * THE SOFTWARE.
  */
 
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 
 #include "flashcodeinstall.h"
 #include "firmware.h"
 #include "display.h"
-#include "hal_watchdog.h"
+#include "flashcodejobs.h"
+#include "firmwaretrailer.h"
+#include "updatestatistics.h"
  #include "firmware/debug/debug_debug.h"
 
+#if defined(GD32F10X) || defined(GD32F20X)
+/*
+ * A sector of FlashCode is made of whole flash pages, so it can be erased on its own.
+ * Only the sectors that differ from the installed firmware are erased and programmed.
+ */
+# define FLASHCODEINSTALL_DIFFERENTIAL
+/*
+ * The boot record is kept in the last bytes of the firmware area. Its sector is shared with
+ * the end of a large image, so the record is only cleared when the image in that slot is replaced,
+ * or is no longer needed.
+ */
+# define FLASHCODEINSTALL_BOOT_RECORD
+#endif
+
+#if defined(GD32)
+/*
+ * An LZ4 frame is decompressed while it is streamed, the match history is read back
+ * from the stream buffers and the memory-mapped flash.
+ * A patch reads the installed firmware from the memory-mapped flash.
+ */
+# define FLASHCODEINSTALL_COMPRESSED
+#endif
+
+uint32_t FlashCodeInstall::GetEraseSize(uint32_t size) const
+{
+    const auto kSectorSize = FlashCode::GetSectorSize();
+    return (size + kSectorSize - 1) & ~(kSectorSize - 1);
+}
+
+#if defined(FLASHCODEINSTALL_DIFFERENTIAL)
+/*
+ * Compares a sector with the memory-mapped flash, the offset is in the flash.
+ * The part of the sector beyond the firmware must be erased, as it would be after programming.
+ */
+bool FlashCodeInstall::IsSectorEqual(uint32_t offset, const uint8_t* data, uint32_t length) const
+{
+    const auto kSectorSize = FlashCode::GetSectorSize();
+    const auto* const kFlash = reinterpret_cast<const uint8_t*>(FLASH_BASE + offset);
+
+    assert(length <= kSectorSize);
+
+    if (memcmp(kFlash, data, length) != 0)
+    {
+        return false;
+    }
+
+    for (auto i = length; i < kSectorSize; i++)
+    {
+        if (kFlash[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+/*
+ * The flash work is done by the flash job queue, serviced from the superloop.
+ * The errors are reported by the queue, here only the state is kept.
+ */
+void FlashCodeInstall::EraseDone(const flashcode::jobs::Job& job)
+{
+    if (flashcode::Result::kOk == job.result)
+    {
+        s_this->erased_size_ = job.length;
+    }
+    else
+    {
+        s_this->erase_size_ = 0;
+        s_this->erased_size_ = 0;
+        s_this->is_error_ = true;
+    }
+
+    DEBUG_PRINTF("erased_size_=%u", static_cast<unsigned int>(s_this->erased_size_));
+}
+
+void FlashCodeInstall::JobDone(const flashcode::jobs::Job& job)
+{
+    if (flashcode::Result::kError == job.result)
+    {
+        s_this->is_error_ = true;
+    }
+}
+
+void FlashCodeInstall::ProgramDone(const flashcode::jobs::Job& job)
+{
+    if (flashcode::Result::kError == job.result)
+    {
+        s_this->is_error_ = true;
+    }
+
+    DEBUG_PRINTF("offset=%x, length=%u", static_cast<unsigned int>(job.offset), static_cast<unsigned int>(job.length));
+
+    s_this->is_programming_ = false;
+    Display::Get()->Progress();
+}
+
+void FlashCodeInstall::CrcDone(const flashcode::jobs::Job& job)
+{
+    if ((flashcode::Result::kOk == job.result) && (job.crc == firmware::trailer::kResidue))
+    {
+        return;
+    }
+
+    printf("Error: firmware CRC %x\n", static_cast<unsigned int>(job.crc));
+    s_this->is_error_ = true;
+}
+
+void FlashCodeInstall::Progress([[maybe_unused]] const flashcode::jobs::Job& job)
+{
+    Display::Get()->Progress();
+}
+
+/*
+ * When the queue is full, the queued jobs are completed first.
+ */
+void FlashCodeInstall::Submit(flashcode::jobs::Type type, uint32_t offset, uint32_t length, const uint8_t* buffer, flashcode::jobs::Callback done, flashcode::jobs::Callback progress)
+{
+    while (!flashcode::jobs::Submit(type, offset, length, buffer, done, progress))
+    {
+        flashcode::jobs::Flush();
+    }
+}
+
+bool FlashCodeInstall::Prepare(uint32_t size)
+{
+    DEBUG_ENTRY();
+
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+    if (is_staging_)
+    {
+        // The staging area is erased while it is written
+        DEBUG_EXIT();
+        return (size != 0) && (size <= FIRMWARE_MAX_SIZE);
+    }
+#endif
+
+    const auto kEraseSize = GetEraseSize(size);
+
+    DEBUG_PRINTF("size=%x, kEraseSize=%x", size, kEraseSize);
+
+    if ((size == 0) || (size > FIRMWARE_MAX_SIZE) || ((image_offset_ + kEraseSize) > flash_size_))
+    {
+        printf("Error: (image_offset_ + kEraseSize) %u > flash_size_ %u\n", static_cast<unsigned int>(image_offset_ + kEraseSize), static_cast<unsigned int>(flash_size_));
+        DEBUG_EXIT();
+        return false;
+    }
+
+    flashcode::jobs::Flush();
+
+#if defined(FLASHCODEINSTALL_DIFFERENTIAL)
+    // Nothing is erased in advance, as that would also erase the sectors that do not change
+    erase_size_ = kEraseSize;
+    erased_size_ = kEraseSize;
+#else
+    if (kEraseSize <= erased_size_)
+    {
+        // Erased already, a compressed stream has cleared erase_size_ and asks again for the maximum size
+        erase_size_ = erase_size_ > kEraseSize ? erase_size_ : kEraseSize;
+        DEBUG_EXIT();
+        return true;
+    }
+
+    erase_size_ = kEraseSize;
+    erased_size_ = 0;
+
+    Submit(flashcode::jobs::Type::kErase, image_offset_, kEraseSize, nullptr, EraseDone);
+#endif
+
+    DEBUG_EXIT();
+    return true;
+}
+
+namespace flashcodeinstall
+{
+static constexpr uint32_t kStreamBufferSize = 4096;
+static uint8_t s_stream_buffer[2][kStreamBufferSize] __attribute__((aligned(4)));
+} // namespace flashcodeinstall
+
+void FlashCodeInstall::StreamBegin()
+{
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+    if (have_staging_)
+    {
+        StageBegin();
+        return;
+    }
+#endif
+
+    StreamReset();
+}
+
+void FlashCodeInstall::StreamReset()
+{
+    DEBUG_ENTRY();
+
+    // An aborted transfer can still have flash work pending
+    flashcode::jobs::Flush();
+
+    ClearBootRecord(image_offset_);
+
+    // The flash content is unknown, Prepare must erase again
+    erase_size_ = 0;
+    erased_size_ = 0;
+    stream_offset_ = 0;
+    stream_length_ = 0;
+    stream_index_ = 0;
+    stream_previous_ = nullptr;
+    sectors_written_ = 0;
+    sectors_skipped_ = 0;
+    is_error_ = false;
+    is_programming_ = false;
+#if defined(FLASHCODEINSTALL_COMPRESSED)
+    is_compressed_ = false;
+    is_patch_ = false;
+#endif
+
+    DEBUG_EXIT();
+}
+
+/*
+ * One buffer is being programmed, while the other is being filled.
+ * When both are full, the programming is completed first.
+ */
+bool FlashCodeInstall::StreamCommit()
+{
+    if (is_programming_)
+    {
+        flashcode::jobs::Flush();
+    }
+
+    if (is_error_)
+    {
+        return false;
+    }
+
+    if ((stream_offset_ + stream_length_) > erase_size_)
+    {
+        puts("Error: firmware exceeds the erased size");
+        return false;
+    }
+
+    auto* buffer = flashcodeinstall::s_stream_buffer[stream_index_];
+
+    // The flash is programmed per word
+    while ((stream_length_ & 0x3) != 0)
+    {
+        buffer[stream_length_++] = 0xFF;
+    }
+
+#if defined(FLASHCODEINSTALL_DIFFERENTIAL)
+    // A buffer holds a single sector
+    assert(flashcodeinstall::kStreamBufferSize == FlashCode::GetSectorSize());
+
+    if (IsSectorEqual(image_offset_ + stream_offset_, buffer, stream_length_))
+    {
+        sectors_skipped_++;
+        stream_offset_ += stream_length_;
+        stream_length_ = 0;
+        // The buffer is filled again, the sector is read from the flash
+        stream_previous_ = nullptr;
+        return true;
+    }
+
+    sectors_written_++;
+
+    // The sector is erased just before it is programmed
+    Submit(flashcode::jobs::Type::kErase, image_offset_ + stream_offset_, FlashCode::GetSectorSize(), nullptr, JobDone);
+#endif
+
+    is_programming_ = true;
+
+    Submit(flashcode::jobs::Type::kProgram, image_offset_ + stream_offset_, stream_length_, buffer, ProgramDone);
+
+    stream_offset_ += stream_length_;
+    stream_length_ = 0;
+    stream_previous_ = buffer;
+    stream_index_ ^= 1;
+
+    return true;
+}
+
+#if defined(FLASHCODEINSTALL_COMPRESSED)
+bool FlashCodeInstall::DecoderPut(uint8_t c)
+{
+    auto* buffer = flashcodeinstall::s_stream_buffer[s_this->stream_index_];
+
+    buffer[s_this->stream_length_++] = c;
+
+    if (s_this->stream_length_ == flashcodeinstall::kStreamBufferSize)
+    {
+        return s_this->StreamCommit();
+    }
+
+    return true;
+}
+
+/*
+ * The sector before the one being filled can still be programming, it is read from its buffer.
+ * Anything older has been programmed already.
+ */
+uint8_t FlashCodeInstall::DecoderPeek(uint32_t distance)
+{
+    const auto kOffset = s_this->stream_offset_ + s_this->stream_length_ - distance;
+
+    if (kOffset >= s_this->stream_offset_)
+    {
+        return flashcodeinstall::s_stream_buffer[s_this->stream_index_][kOffset - s_this->stream_offset_];
+    }
+
+    if ((s_this->stream_previous_ != nullptr) && ((kOffset + flashcodeinstall::kStreamBufferSize) >= s_this->stream_offset_))
+    {
+        return s_this->stream_previous_[kOffset + flashcodeinstall::kStreamBufferSize - s_this->stream_offset_];
+    }
+
+    return *reinterpret_cast<const uint8_t*>(FLASH_BASE + s_this->image_offset_ + kOffset);
+}
+
+/*
+ * The patch must be made for the installed firmware, which is always in slot A.
+ * Installed over the old image, a patch must be made for that, and needs the differential install,
+ * where a sector is only erased once its new content is known.
+ */
+bool FlashCodeInstall::PatchCheck(const firmware::patch::Header& header)
+{
+    DEBUG_PRINTF("flags=%x, old_size=%u, old_crc=%x, new_size=%u", header.flags, header.old_size, header.old_crc, header.new_size);
+
+    if ((header.old_size < sizeof(struct firmware::trailer::Trailer)) || (header.old_size > FIRMWARE_MAX_SIZE) || ((header.old_size & 0x3) != 0) || (header.new_size > FIRMWARE_MAX_SIZE))
+    {
+        puts("Error: patch header");
+        return false;
+    }
+
+    if (s_this->image_offset_ == OFFSET_UIMAGE)
+    {
+# if defined(FLASHCODEINSTALL_DIFFERENTIAL)
+        const auto kSectorSize = s_this->FlashCode::GetSectorSize();
+        // The sector with the boot record has been erased by StreamBegin
+        const auto kRecordSector = (FIRMWARE_MAX_SIZE - sizeof(struct firmware::trailer::Record)) & ~(kSectorSize - 1);
+
+        if (((header.flags & firmware::patch::kFlagInPlace) == 0) || (header.old_size > kRecordSector))
+        {
+            puts("Error: patch cannot be installed in place");
+            return false;
+        }
+# else
+        puts("Error: patch needs a second slot");
+        return false;
+# endif
+    }
+
+    firmware::trailer::Trailer trailer;
+    memcpy(&trailer, reinterpret_cast<const void*>(FLASH_BASE + OFFSET_UIMAGE + header.old_size - sizeof(struct firmware::trailer::Trailer)), sizeof(struct firmware::trailer::Trailer));
+
+    if ((trailer.magic != firmware::trailer::kMagic) || (trailer.length != (header.old_size - sizeof(struct firmware::trailer::Trailer))) || (trailer.crc != header.old_crc))
+    {
+        puts("Error: patch is for another firmware");
+        return false;
+    }
+
+    return true;
+}
+
+bool FlashCodeInstall::PatchSource(uint32_t offset, uint8_t& c)
+{
+    // In place, a sector that has been committed no longer holds the installed firmware
+    if ((s_this->image_offset_ == OFFSET_UIMAGE) && (offset < s_this->stream_offset_))
+    {
+        return false;
+    }
+
+    c = *reinterpret_cast<const uint8_t*>(FLASH_BASE + OFFSET_UIMAGE + offset);
+    return true;
+}
+#endif
+
+bool FlashCodeInstall::StreamWrite(const uint8_t* data, uint32_t length)
+{
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+    if (is_staging_)
+    {
+        return StageWrite(data, length);
+    }
+#endif
+
+    if (is_error_)
+    {
+        return false;
+    }
+
+#if defined(FLASHCODEINSTALL_COMPRESSED)
+    if (!is_compressed_ && !is_patch_ && (stream_offset_ == 0) && (stream_length_ == 0))
+    {
+        if (firmware::lz4::IsFrame(data, length))
+        {
+            puts("LZ4 compressed firmware");
+            is_compressed_ = true;
+            decoder_.Reset();
+            // The size announced is the compressed size
+            erase_size_ = 0;
+        }
+        else if (firmware::patch::IsPatch(data, length))
+        {
+            puts("Delta firmware");
+            is_patch_ = true;
+            patch_.Reset();
+            erase_size_ = 0;
+        }
+    }
+#endif
+
+    if (erase_size_ == 0)
+    {
+        // No size was announced
+        if (!Prepare(FIRMWARE_MAX_SIZE))
+        {
+            return false;
+        }
+    }
+
+#if defined(FLASHCODEINSTALL_COMPRESSED)
+    if (is_compressed_)
+    {
+        if (!decoder_.Update(data, length))
+        {
+            puts("Error: LZ4 frame");
+            return false;
+        }
+
+        return true;
+    }
+
+    if (is_patch_)
+    {
+        if (!patch_.Update(data, length))
+        {
+            puts("Error: patch");
+            return false;
+        }
+
+        return true;
+    }
+#endif
+
+    while (length != 0)
+    {
+        auto* buffer = flashcodeinstall::s_stream_buffer[stream_index_];
+        const auto kAvailable = flashcodeinstall::kStreamBufferSize - stream_length_;
+        const auto kCopy = length < kAvailable ? length : kAvailable;
+
+        memcpy(&buffer[stream_length_], data, kCopy);
+
+        stream_length_ += kCopy;
+        data += kCopy;
+        length -= kCopy;
+
+        if (stream_length_ == flashcodeinstall::kStreamBufferSize)
+        {
+            if (!StreamCommit())
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool FlashCodeInstall::StreamEnd()
+{
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+    if (is_staging_)
+    {
+        // The staged file is verified, and then streamed into the internal flash
+        return StageEnd();
+    }
+#endif
+
+    DEBUG_ENTRY();
+
+#if defined(FLASHCODEINSTALL_COMPRESSED)
+    if (is_compressed_ && !decoder_.IsDone())
+    {
+        puts("Error: LZ4 frame is incomplete");
+        DEBUG_EXIT();
+        return false;
+    }
+
+    if (is_patch_ && !patch_.IsDone())
+    {
+        puts("Error: patch is incomplete");
+        DEBUG_EXIT();
+        return false;
+    }
+#endif
+
+    image_size_ = stream_offset_ + stream_length_;
+
+    if ((stream_length_ != 0) && !StreamCommit())
+    {
+        DEBUG_EXIT();
+        return false;
+    }
+
+    flashcode::jobs::Flush();
+
+    DEBUG_PRINTF("stream_offset_=%u, is_error_=%d", static_cast<unsigned int>(stream_offset_), is_error_);
+
+#if defined(FLASHCODEINSTALL_DIFFERENTIAL)
+    printf("Sectors written %u, unchanged %u\n", static_cast<unsigned int>(sectors_written_), static_cast<unsigned int>(sectors_skipped_));
+    firmware::update::SetSectors(sectors_written_, sectors_skipped_);
+#endif
+
+    // The erased sectors are programmed now
+    erase_size_ = 0;
+    erased_size_ = 0;
+
+    DEBUG_EXIT();
+    return !is_error_;
+}
+
+/*
+ * A new install starts without a boot record, so the bootloader does the full check
+ * until the install has been verified. For slot B the record is the marker that it holds
+ * a verified image to be activated.
+ * The whole sector holding the record is erased, together with the end of the image in it.
+ */
+void FlashCodeInstall::ClearBootRecord([[maybe_unused]] uint32_t offset)
+{
+#if defined(FLASHCODEINSTALL_BOOT_RECORD)
+    const auto kRecordOffset = offset + FIRMWARE_MAX_SIZE - static_cast<uint32_t>(sizeof(struct firmware::trailer::Record));
+    const auto* const kRecord = reinterpret_cast<const uint32_t*>(FLASH_BASE + kRecordOffset);
+
+    for (uint32_t i = 0; i < (sizeof(struct firmware::trailer::Record) / 4); i++)
+    {
+        if (kRecord[i] != 0xFFFFFFFF)
+        {
+            const auto kSectorSize = FlashCode::GetSectorSize();
+
+            Submit(flashcode::jobs::Type::kErase, kRecordOffset & ~(kSectorSize - 1), kSectorSize, nullptr, JobDone);
+            flashcode::jobs::Flush();
+            return;
+        }
+    }
+#endif
+}
+
+/*
+ * Without room for the record, the bootloader does the full check at every boot.
+ * A failure to program the record is therefore not an install error.
+ */
+void FlashCodeInstall::WriteBootRecord([[maybe_unused]] uint32_t offset, [[maybe_unused]] uint32_t size)
+{
+#if defined(FLASHCODEINSTALL_BOOT_RECORD)
+    static firmware::trailer::Record s_record;
+
+    if (!firmware::trailer::MakeRecord(reinterpret_cast<const uint8_t*>(FLASH_BASE + offset), size, FIRMWARE_MAX_SIZE, s_record))
+    {
+        puts("No room for the boot record");
+        return;
+    }
+
+    Submit(flashcode::jobs::Type::kProgram, offset + FIRMWARE_MAX_SIZE - sizeof(struct firmware::trailer::Record), sizeof(struct firmware::trailer::Record),
+           reinterpret_cast<const uint8_t*>(&s_record), nullptr);
+    flashcode::jobs::Flush();
+#endif
+}
+
+bool FlashCodeInstall::CheckCrc(uint32_t offset, uint32_t size)
+{
+    if (size < sizeof(struct firmware::trailer::Trailer))
+    {
+        return false;
+    }
+
+    Display::Get()->TextStatus("Verify", console::Colours::kConsoleGreen);
+
+    flashcode::jobs::Flush();
+
+    is_error_ = false;
+
+    Submit(flashcode::jobs::Type::kCrc, offset, size, nullptr, CrcDone);
+    flashcode::jobs::Flush();
+
+    if (!is_error_)
+    {
+        WriteBootRecord(offset, size);
+    }
+
+    return !is_error_;
+}
+
+bool FlashCodeInstall::VerifyImage(uint32_t size)
+{
+    DEBUG_ENTRY();
+
+    const auto kIsOk = CheckCrc(image_offset_, size);
+
+    if (kIsOk && (image_offset_ != OFFSET_UIMAGE))
+    {
+        puts("Firmware is activated at the next boot");
+    }
+
+    DEBUG_EXIT();
+    return kIsOk;
+}
+
+#if defined(OFFSET_SLOT_B)
+# if !defined(FLASHCODEINSTALL_DIFFERENTIAL)
+#  error "Slot B is copied per sector, the sectors must be erased on their own"
+# endif
+/*
+ * Slot A is changed only after slot B has been verified, and the marker of slot B is cleared last.
+ * An interrupted copy is therefore done again at the next boot.
+ * Only the sectors of slot A that differ from slot B are erased and programmed.
+ */
+bool FlashCodeInstall::ActivateSlot()
+{
+    DEBUG_ENTRY();
+
+    const auto* const kSlotB = reinterpret_cast<const uint8_t*>(FLASH_BASE + OFFSET_SLOT_B);
+
+    if (!firmware::trailer::IsVerified(kSlotB, FIRMWARE_MAX_SIZE))
+    {
+        DEBUG_EXIT();
+        return false;
+    }
+
+    firmware::trailer::Record record;
+    memcpy(&record, &kSlotB[FIRMWARE_MAX_SIZE - sizeof(struct firmware::trailer::Record)], sizeof(struct firmware::trailer::Record));
+
+    const auto kSize = record.length + static_cast<uint32_t>(sizeof(struct firmware::trailer::Trailer));
+
+    puts("Activate slot B");
+    Display::Get()->TextStatus("Activate", console::Colours::kConsoleGreen);
+
+    flashcode::jobs::Flush();
+
+    is_error_ = false;
+
+    ClearBootRecord(OFFSET_UIMAGE);
+
+    const auto kSectorSize = FlashCode::GetSectorSize();
+
+    sectors_written_ = 0;
+    sectors_skipped_ = 0;
+
+    for (uint32_t offset = 0; offset < kSize; offset += kSectorSize)
+    {
+        const auto kLength = (kSize - offset) < kSectorSize ? (kSize - offset) : kSectorSize;
+
+        if (IsSectorEqual(OFFSET_UIMAGE + offset, &kSlotB[offset], kLength))
+        {
+            sectors_skipped_++;
+            continue;
+        }
+
+        sectors_written_++;
+
+        Submit(flashcode::jobs::Type::kErase, OFFSET_UIMAGE + offset, kSectorSize, nullptr, JobDone);
+        // Programmed straight from the memory-mapped slot B
+        Submit(flashcode::jobs::Type::kProgram, OFFSET_UIMAGE + offset, kLength, &kSlotB[offset], JobDone, Progress);
+    }
+
+    flashcode::jobs::Flush();
+
+    printf("Sectors written %u, unchanged %u\n", static_cast<unsigned int>(sectors_written_), static_cast<unsigned int>(sectors_skipped_));
+
+    if (is_error_ || !CheckCrc(OFFSET_UIMAGE, kSize))
+    {
+        DEBUG_EXIT();
+        return false;
+    }
+
+    ClearBootRecord(OFFSET_SLOT_B);
+
+    Display::Get()->TextStatus("Done", console::Colours::kConsoleGreen);
+
+    DEBUG_EXIT();
+    return true;
+}
+#else
+bool FlashCodeInstall::ActivateSlot()
+{
+    return false;
+}
+#endif
+
+void FlashCodeInstall::Invalidate()
+{
+    DEBUG_ENTRY();
+
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+    if (is_staging_)
+    {
+        // Only the staging area has been written, the installed firmware is kept
+        is_staging_ = false;
+        DEBUG_EXIT();
+        return;
+    }
+#endif
+
+    flashcode::jobs::Flush();
+
+    Submit(flashcode::jobs::Type::kErase, image_offset_, FlashCode::GetSectorSize(), nullptr, JobDone);
+    flashcode::jobs::Flush();
+
+    // The flash content is unknown, Prepare must erase again
+    erase_size_ = 0;
+    erased_size_ = 0;
+
+    DEBUG_EXIT();
+}
+
 bool FlashCodeInstall::WriteFirmware(const uint8_t* buffer, uint32_t size)
 {
     DEBUG_ENTRY();
@@ -38,54 +758,123 @@ bool FlashCodeInstall::WriteFirmware(const uint8_t* buffer, uint32_t size)
     assert(buffer != nullptr);
     assert(size != 0);
 
-    DEBUG_PRINTF("(%p + %p)=%p, flash_size_=%u", OFFSET_UIMAGE, size, (OFFSET_UIMAGE + size), static_cast<unsigned int>(flash_size_));
+    DEBUG_PRINTF("(%p + %p)=%p, flash_size_=%u", image_offset_, size, (image_offset_ + size), static_cast<unsigned int>(flash_size_));
 
-    if ((OFFSET_UIMAGE + size) > flash_size_)
+    if ((image_offset_ + size) > flash_size_)
     {
-        printf("Error: (OFFSET_UIMAGE + size) %u > flash_size_ %u\n", static_cast<unsigned int>(OFFSET_UIMAGE + size), static_cast<unsigned int>(flash_size_));
+        printf("Error: (image_offset_ + size) %u > flash_size_ %u\n", static_cast<unsigned int>(image_offset_ + size), static_cast<unsigned int>(flash_size_));
         DEBUG_EXIT();
         return false;
     }
 
-    const auto kWatchdog = hal::Watchdog();
+    puts("Write firmware");
 
-    if (kWatchdog)
+#if defined(FLASHCODEINSTALL_COMPRESSED)
+    if (firmware::lz4::IsFrame(buffer, size) || firmware::patch::IsPatch(buffer, size))
     {
-        hal::WatchdogStop();
+        // The buffer is the compressed file or the patch, it is streamed as if it arrives
+        StreamReset();
+
+        if (!StreamWrite(buffer, size) || !StreamEnd() || !VerifyImage(image_size_))
+        {
+            Invalidate();
+            DEBUG_EXIT();
+            return false;
+        }
+
+        Display::Get()->TextStatus("Done", console::Colours::kConsoleGreen);
+
+        DEBUG_EXIT();
+        return true;
     }
+#endif
 
-    puts("Write firmware");
+    image_size_ = size;
+
+    // The watchdog is fed by the flash job queue
+    flashcode::jobs::Flush();
+
+    ClearBootRecord(image_offset_);
+
+    is_error_ = false;
+
+#if defined(FLASHCODEINSTALL_DIFFERENTIAL)
+    erase_size_ = 0;
+    erased_size_ = 0;
+
+    Display::Get()->TextStatus("Writing", console::Colours::kConsoleGreen);
 
     const auto kSectorSize = FlashCode::GetSectorSize();
-    const auto kEraseSize = (size + kSectorSize - 1) & ~(kSectorSize - 1);
 
-    DEBUG_PRINTF("size=%x, kSectorSize=%x, kEraseSize=%x", size, kSectorSize, kEraseSize);
+    sectors_written_ = 0;
+    sectors_skipped_ = 0;
 
-    Display::Get()->TextStatus("Erase", console::Colours::kConsoleGreen);
+    for (uint32_t offset = 0; offset < size; offset += kSectorSize)
+    {
+        const auto kLength = (size - offset) < kSectorSize ? (size - offset) : kSectorSize;
 
-    flashcode::Result result;
+        if (IsSectorEqual(image_offset_ + offset, &buffer[offset], kLength))
+        {
+            sectors_skipped_++;
+            continue;
+        }
 
-    while (!FlashCode::Erase(OFFSET_UIMAGE, kEraseSize, result));
+        sectors_written_++;
 
-    if (flashcode::Result::kError == result)
+        Submit(flashcode::jobs::Type::kErase, image_offset_ + offset, kSectorSize, nullptr, JobDone);
+        Submit(flashcode::jobs::Type::kProgram, image_offset_ + offset, kLength, &buffer[offset], ProgramDone);
+    }
+
+    flashcode::jobs::Flush();
+
+    printf("Sectors written %u, unchanged %u\n", static_cast<unsigned int>(sectors_written_), static_cast<unsigned int>(sectors_skipped_));
+    firmware::update::SetSectors(sectors_written_, sectors_skipped_);
+#else
+    const auto kEraseSize = GetEraseSize(size);
+
+    DEBUG_PRINTF("size=%x, kEraseSize=%x, erased_size_=%x", size, kEraseSize, erased_size_);
+
+    if (kEraseSize > erased_size_)
     {
-        puts("Error: flash erase");
-        return false;
+        Display::Get()->TextStatus("Erase", console::Colours::kConsoleGreen);
+
+        Submit(flashcode::jobs::Type::kErase, image_offset_, kEraseSize, nullptr, EraseDone);
+        flashcode::jobs::Flush();
     }
 
-    Display::Get()->TextStatus("Writing", console::Colours::kConsoleGreen);
+    erase_size_ = 0;
+    erased_size_ = 0;
+
+    if (!is_error_)
+    {
+        Display::Get()->TextStatus("Writing", console::Colours::kConsoleGreen);
 
-    while (!FlashCode::Write(OFFSET_UIMAGE, size, buffer, result));
+        // Progress is reported per sector
+        Submit(flashcode::jobs::Type::kProgram, image_offset_, size, buffer, ProgramDone, Progress);
+        flashcode::jobs::Flush();
+    }
+#endif
 
-    if (flashcode::Result::kError == result)
+#if defined(GD32)
+    // The buffer ends with the trailer, checked when it was received
+    if (!is_error_ && !VerifyImage(size))
     {
-        puts("Error: flash write");
-        return false;
+        Invalidate();
     }
+#else
+    if (!is_error_)
+    {
+        Display::Get()->TextStatus("Verify", console::Colours::kConsoleGreen);
+
+        Submit(flashcode::jobs::Type::kVerify, image_offset_, size, buffer, JobDone);
+        flashcode::jobs::Flush();
+    }
+#endif
 
-    if (kWatchdog)
+    if (is_error_)
     {
-        hal::WatchdogInit();
+        DEBUG_EXIT();
+        return false;
     }
 
     Display::Get()->TextStatus("Done", console::Colours::kConsoleGreen);
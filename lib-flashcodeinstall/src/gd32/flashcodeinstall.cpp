@@ -45,6 +45,18 @@ FlashCodeInstall::FlashCodeInstall()
     flash_size_ = FlashCode::GetSize();
 
     printf("FlashCodeInstall: %s, sector size %d, %d bytes [%d kB]\n", FlashCode::GetName(), FlashCode::GetSectorSize(), flash_size_, flash_size_ / 1024U);
+
+#if defined(OFFSET_SLOT_B)
+    // Slot B must stay clear of the configuration store in the last sector
+    if ((OFFSET_SLOT_B + GetEraseSize(FIRMWARE_MAX_SIZE)) <= (flash_size_ - FlashCode::GetSectorSize()))
+    {
+        image_offset_ = OFFSET_SLOT_B;
+        printf("Slot B at %x\n", static_cast<unsigned int>(image_offset_));
+    }
+#endif
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+    have_staging_ = StageProbe();
+#endif
     Display::Get()->Write(1, FlashCode::GetName());
 
     DEBUG_EXIT();
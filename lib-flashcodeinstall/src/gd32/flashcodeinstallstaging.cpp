@@ -0,0 +1,206 @@
+/**
+ * @file flashcodeinstallstaging.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#if defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "flashcodeinstall.h"
+#include "firmware.h"
+#include "firmwaretrailer.h"
+#include "display.h"
+#include "spi/spi_flash.h"
+#include "firmware/debug/debug_debug.h"
+
+/*
+ * The received file is staged at the start of the SPI flash, the configuration store is at the end.
+ * The installed firmware is only touched once the staged copy has been read back and verified.
+ * The file is then streamed from the SPI flash, as if it arrives again.
+ */
+namespace flashcodeinstall
+{
+static constexpr uint32_t kStageOffset = 0;
+static constexpr uint32_t kStageChunkSize = 4096;
+static uint8_t s_stage_buffer[kStageChunkSize] __attribute__((aligned(4)));
+} // namespace flashcodeinstall
+
+bool FlashCodeInstall::StageProbe()
+{
+    if (!spi_flash_probe())
+    {
+        puts("Staging: no SPI flash");
+        return false;
+    }
+
+    // Room must be left for the configuration store
+    if (FIRMWARE_MAX_SIZE > (spi_flash_get_size() / 2))
+    {
+        printf("Staging: %s is too small\n", spi_flash_get_name());
+        return false;
+    }
+
+    printf("Staging: %s, %u bytes\n", spi_flash_get_name(), static_cast<unsigned int>(FIRMWARE_MAX_SIZE));
+    return true;
+}
+
+void FlashCodeInstall::StageBegin()
+{
+    DEBUG_ENTRY();
+
+    stage_offset_ = 0;
+    stage_length_ = 0;
+    is_staging_ = true;
+    is_error_ = false;
+
+    DEBUG_EXIT();
+}
+
+/*
+ * The sectors are erased when they are first written, a full erase in advance would stall the transfer.
+ */
+bool FlashCodeInstall::StageFlush()
+{
+    const auto kSectorSize = spi_flash_get_sector_size();
+    const auto kEnd = stage_offset_ + stage_length_;
+
+    for (auto offset = ((stage_offset_ + kSectorSize - 1) / kSectorSize) * kSectorSize; offset < kEnd; offset += kSectorSize)
+    {
+        if (!spi_flash_cmd_erase(flashcodeinstall::kStageOffset + offset, kSectorSize))
+        {
+            printf("Error: SPI flash erase at %x\n", static_cast<unsigned int>(offset));
+            return false;
+        }
+    }
+
+    if (!spi_flash_cmd_write_multi(flashcodeinstall::kStageOffset + stage_offset_, stage_length_, flashcodeinstall::s_stage_buffer))
+    {
+        printf("Error: SPI flash write at %x\n", static_cast<unsigned int>(stage_offset_));
+        return false;
+    }
+
+    stage_offset_ = kEnd;
+    stage_length_ = 0;
+
+    Display::Get()->Progress();
+
+    return true;
+}
+
+bool FlashCodeInstall::StageWrite(const uint8_t* data, uint32_t length)
+{
+    if (is_error_)
+    {
+        return false;
+    }
+
+    if ((stage_offset_ + stage_length_ + length) > FIRMWARE_MAX_SIZE)
+    {
+        puts("Error: firmware exceeds the staging area");
+        is_error_ = true;
+        return false;
+    }
+
+    while (length != 0)
+    {
+        const auto kAvailable = flashcodeinstall::kStageChunkSize - stage_length_;
+        const auto kCopy = length < kAvailable ? length : kAvailable;
+
+        memcpy(&flashcodeinstall::s_stage_buffer[stage_length_], data, kCopy);
+
+        stage_length_ += kCopy;
+        data += kCopy;
+        length -= kCopy;
+
+        if ((stage_length_ == flashcodeinstall::kStageChunkSize) && !StageFlush())
+        {
+            is_error_ = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The staged file is read back in whole chunks, for the trailer check and then for the install.
+ */
+bool FlashCodeInstall::StageEnd()
+{
+    DEBUG_ENTRY();
+
+    if (is_error_ || ((stage_length_ != 0) && !StageFlush()))
+    {
+        DEBUG_EXIT();
+        return false;
+    }
+
+    const auto kSize = stage_offset_;
+
+    firmware::trailer::Check check;
+    check.Reset();
+
+    for (uint32_t offset = 0; offset < kSize; offset += flashcodeinstall::kStageChunkSize)
+    {
+        const auto kLength = (kSize - offset) < flashcodeinstall::kStageChunkSize ? (kSize - offset) : flashcodeinstall::kStageChunkSize;
+
+        if (!spi_flash_cmd_read_fast(flashcodeinstall::kStageOffset + offset, kLength, flashcodeinstall::s_stage_buffer))
+        {
+            puts("Error: SPI flash read");
+            DEBUG_EXIT();
+            return false;
+        }
+
+        check.Update(flashcodeinstall::s_stage_buffer, kLength);
+    }
+
+    if (!check.IsValid())
+    {
+        puts("Error: staged firmware trailer or CRC");
+        DEBUG_EXIT();
+        return false;
+    }
+
+    printf("Staged firmware %u bytes\n", static_cast<unsigned int>(kSize));
+
+    // From here on, the internal flash is written
+    is_staging_ = false;
+    StreamReset();
+
+    for (uint32_t offset = 0; offset < kSize; offset += flashcodeinstall::kStageChunkSize)
+    {
+        const auto kLength = (kSize - offset) < flashcodeinstall::kStageChunkSize ? (kSize - offset) : flashcodeinstall::kStageChunkSize;
+
+        if (!spi_flash_cmd_read_fast(flashcodeinstall::kStageOffset + offset, kLength, flashcodeinstall::s_stage_buffer) || !StreamWrite(flashcodeinstall::s_stage_buffer, kLength))
+        {
+            DEBUG_EXIT();
+            return false;
+        }
+    }
+
+    DEBUG_EXIT();
+    return StreamEnd();
+}
+#endif
@@ -0,0 +1,282 @@
+/**
+ * @file lz4decoder.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+
+#include "lz4decoder.h"
+#include "firmware/debug/debug_debug.h"
+
+namespace firmware::lz4
+{
+/* FLG */
+static constexpr uint8_t kVersionMask = 0xC0;
+static constexpr uint8_t kVersion = 0x40;
+static constexpr uint8_t kBlockChecksum = 0x10;
+static constexpr uint8_t kContentSize = 0x08;
+static constexpr uint8_t kContentChecksum = 0x04;
+static constexpr uint8_t kDictId = 0x01;
+
+static constexpr uint32_t kBlockUncompressed = 0x80000000;
+static constexpr uint32_t kMinMatch = 4;
+
+bool Decoder::Output(uint8_t c)
+{
+    if (!put_(c))
+    {
+        state_ = State::kError;
+        return false;
+    }
+
+    size_++;
+    return true;
+}
+
+/*
+ * The last sequence of a block has literals only.
+ */
+void Decoder::AfterLiterals()
+{
+    if (block_remaining_ == 0)
+    {
+        EndBlock();
+        return;
+    }
+
+    state_ = State::kOffset;
+    count_ = 0;
+    value_ = 0;
+}
+
+void Decoder::EndBlock()
+{
+    state_ = ((flags_ & kBlockChecksum) != 0) ? State::kBlockChecksum : State::kBlockSize;
+    count_ = 0;
+    value_ = 0;
+}
+
+/*
+ * The match can overlap the bytes it writes, hence the copy per byte.
+ */
+bool Decoder::Copy()
+{
+    for (auto i = match_length_ + kMinMatch; i != 0; i--)
+    {
+        if (!Output(peek_(value_)))
+        {
+            return false;
+        }
+    }
+
+    if (block_remaining_ == 0)
+    {
+        EndBlock();
+    }
+    else
+    {
+        state_ = State::kToken;
+    }
+
+    return true;
+}
+
+bool Decoder::Update(const uint8_t* data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        const auto kByte = data[i];
+
+        // Each byte of a compressed block is counted
+        if ((state_ >= State::kToken) && (state_ <= State::kMatchLength))
+        {
+            if (block_remaining_ == 0)
+            {
+                state_ = State::kError;
+            }
+            else
+            {
+                block_remaining_--;
+            }
+        }
+
+        switch (state_)
+        {
+            case State::kHeader:
+                if (count_ < 4)
+                {
+                    // The magic number, little endian
+                    if (kByte != static_cast<uint8_t>(kMagic >> (8 * count_)))
+                    {
+                        state_ = State::kError;
+                        break;
+                    }
+                }
+                else if (count_ == 4)
+                {
+                    flags_ = kByte;
+
+                    if ((flags_ & kVersionMask) != kVersion)
+                    {
+                        state_ = State::kError;
+                        break;
+                    }
+
+                    // Magic, FLG, BD and HC, followed by the optional fields
+                    header_size_ = 7U + (((flags_ & kContentSize) != 0) ? 8U : 0U) + (((flags_ & kDictId) != 0) ? 4U : 0U);
+                }
+
+                if (++count_ == header_size_)
+                {
+                    state_ = State::kBlockSize;
+                    count_ = 0;
+                    value_ = 0;
+                }
+                break;
+            case State::kBlockSize:
+                value_ |= static_cast<uint32_t>(kByte) << (8 * count_);
+
+                if (++count_ == 4)
+                {
+                    if (value_ == 0)
+                    {
+                        // End mark
+                        state_ = ((flags_ & kContentChecksum) != 0) ? State::kContentChecksum : State::kDone;
+                        count_ = 0;
+                        break;
+                    }
+
+                    block_remaining_ = value_ & ~kBlockUncompressed;
+                    state_ = ((value_ & kBlockUncompressed) != 0) ? State::kBlockRaw : State::kToken;
+
+                    if (block_remaining_ == 0)
+                    {
+                        EndBlock();
+                    }
+                }
+                break;
+            case State::kBlockRaw:
+                if (!Output(kByte))
+                {
+                    break;
+                }
+
+                if (--block_remaining_ == 0)
+                {
+                    EndBlock();
+                }
+                break;
+            case State::kToken:
+                literal_length_ = static_cast<uint32_t>(kByte >> 4);
+                match_length_ = static_cast<uint32_t>(kByte & 0xF);
+
+                if (literal_length_ == 15)
+                {
+                    state_ = State::kLiteralLength;
+                }
+                else if (literal_length_ != 0)
+                {
+                    state_ = State::kLiterals;
+                }
+                else
+                {
+                    AfterLiterals();
+                }
+                break;
+            case State::kLiteralLength:
+                literal_length_ += kByte;
+
+                if (kByte != 255)
+                {
+                    state_ = State::kLiterals;
+                }
+                break;
+            case State::kLiterals:
+                if (!Output(kByte))
+                {
+                    break;
+                }
+
+                if (--literal_length_ == 0)
+                {
+                    AfterLiterals();
+                }
+                break;
+            case State::kOffset:
+                value_ |= static_cast<uint32_t>(kByte) << (8 * count_);
+
+                if (++count_ == 2)
+                {
+                    if ((value_ == 0) || (value_ > size_))
+                    {
+                        DEBUG_PRINTF("offset=%u, size_=%u", value_, size_);
+                        state_ = State::kError;
+                        break;
+                    }
+
+                    if (match_length_ == 15)
+                    {
+                        state_ = State::kMatchLength;
+                    }
+                    else
+                    {
+                        Copy();
+                    }
+                }
+                break;
+            case State::kMatchLength:
+                match_length_ += kByte;
+
+                if (kByte != 255)
+                {
+                    Copy();
+                }
+                break;
+            case State::kBlockChecksum:
+                if (++count_ == 4)
+                {
+                    state_ = State::kBlockSize;
+                    count_ = 0;
+                    value_ = 0;
+                }
+                break;
+            case State::kContentChecksum:
+                if (++count_ == 4)
+                {
+                    state_ = State::kDone;
+                }
+                break;
+            case State::kDone:
+                return true;
+                break;
+            case State::kError:
+                return false;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return state_ != State::kError;
+}
+} // namespace firmware::lz4
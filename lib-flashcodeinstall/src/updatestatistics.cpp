@@ -0,0 +1,138 @@
+/**
+ * @file updatestatistics.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "updatestatistics.h"
+#include "flashcodejobs.h"
+#include "hal_millis.h"
+#include "firmware/debug/debug_debug.h"
+
+namespace firmware::update
+{
+static Statistics s_statistics;
+static uint32_t s_begin_millis;
+static uint32_t s_install_millis;
+
+static uint32_t GetBytesPerSecond(uint32_t size, uint32_t millis)
+{
+    if (millis == 0)
+    {
+        return 0;
+    }
+
+    return static_cast<uint32_t>((static_cast<uint64_t>(size) * 1000U) / millis);
+}
+
+void Begin()
+{
+    memset(&s_statistics, 0, sizeof(s_statistics));
+    s_begin_millis = hal::Millis();
+
+    flashcode::jobs::ResetStatistics();
+}
+
+void TransferEnd(uint32_t file_size, uint32_t retransmits, uint32_t out_of_order)
+{
+    s_statistics.file_size = file_size;
+    s_statistics.transfer_millis = hal::Millis() - s_begin_millis;
+    s_statistics.retransmits = retransmits;
+    s_statistics.out_of_order = out_of_order;
+
+    s_install_millis = hal::Millis();
+}
+
+void InstallBegin()
+{
+    s_install_millis = hal::Millis();
+}
+
+void SetSectors(uint32_t written, uint32_t skipped)
+{
+    s_statistics.sectors_written = written;
+    s_statistics.sectors_skipped = skipped;
+}
+
+void End(bool is_ok, uint32_t image_size)
+{
+    using flashcode::jobs::GetStatistics;
+    using flashcode::jobs::Type;
+
+    s_statistics.image_size = image_size;
+    s_statistics.total_millis = s_statistics.transfer_millis + (hal::Millis() - s_install_millis);
+    s_statistics.erase_millis = GetStatistics(Type::kErase).micros / 1000U;
+    s_statistics.program_millis = GetStatistics(Type::kProgram).micros / 1000U;
+    s_statistics.verify_millis = (GetStatistics(Type::kVerify).micros + GetStatistics(Type::kCrc).micros) / 1000U;
+    s_statistics.erased_size = GetStatistics(Type::kErase).bytes;
+    s_statistics.is_done = true;
+    s_statistics.is_ok = is_ok;
+
+    const auto& s = s_statistics;
+    const auto kBytesPerSecond = GetBytesPerSecond(s.file_size, s.transfer_millis);
+
+    printf("Update %s\n", s.is_ok ? "done" : "failed");
+    printf(" Transfer %u bytes in %u ms, %u B/s, retransmits %u, out of order %u\n", static_cast<unsigned int>(s.file_size), static_cast<unsigned int>(s.transfer_millis),
+           static_cast<unsigned int>(kBytesPerSecond), static_cast<unsigned int>(s.retransmits), static_cast<unsigned int>(s.out_of_order));
+    printf(" Flash erase %u ms (%u bytes), program %u ms, verify %u ms\n", static_cast<unsigned int>(s.erase_millis), static_cast<unsigned int>(s.erased_size),
+           static_cast<unsigned int>(s.program_millis), static_cast<unsigned int>(s.verify_millis));
+    printf(" Sectors written %u, unchanged %u\n", static_cast<unsigned int>(s.sectors_written), static_cast<unsigned int>(s.sectors_skipped));
+    printf(" Image %u bytes, total %u ms\n", static_cast<unsigned int>(s.image_size), static_cast<unsigned int>(s.total_millis));
+}
+
+const Statistics& Get()
+{
+    return s_statistics;
+}
+
+uint32_t Format(char* buffer, uint32_t size)
+{
+    const auto& s = s_statistics;
+
+    if (!s.is_done)
+    {
+        return static_cast<uint32_t>(snprintf(buffer, size, "update:None\n"));
+    }
+
+    const auto kBytesPerSecond = GetBytesPerSecond(s.file_size, s.transfer_millis);
+    const auto kLength = snprintf(buffer, size,
+                                  "update:%s,file=%u,image=%u,transfer=%ums,rate=%uB/s,retransmits=%u,out_of_order=%u,erase=%ums,erased=%u,program=%ums,verify=%ums,"
+                                  "written=%u,unchanged=%u,total=%ums\n",
+                                  s.is_ok ? "Ok" : "Failed", static_cast<unsigned int>(s.file_size), static_cast<unsigned int>(s.image_size),
+                                  static_cast<unsigned int>(s.transfer_millis), static_cast<unsigned int>(kBytesPerSecond), static_cast<unsigned int>(s.retransmits),
+                                  static_cast<unsigned int>(s.out_of_order), static_cast<unsigned int>(s.erase_millis), static_cast<unsigned int>(s.erased_size),
+                                  static_cast<unsigned int>(s.program_millis), static_cast<unsigned int>(s.verify_millis), static_cast<unsigned int>(s.sectors_written),
+                                  static_cast<unsigned int>(s.sectors_skipped), static_cast<unsigned int>(s.total_millis));
+
+    if (kLength < 0)
+    {
+        return 0;
+    }
+
+    // Truncated
+    return (static_cast<uint32_t>(kLength) < size) ? static_cast<uint32_t>(kLength) : (size - 1);
+}
+} // namespace firmware::update
@@ -0,0 +1,211 @@
+/**
+ * @file test_activate.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host test of the activation of slot B, with the flash and the flash job queue in RAM.
+ * A GD32F107RC board is used, where the sectors are erased on their own.
+ * Only the sectors of slot A that differ from slot B may be erased and programmed.
+ *
+ * cd lib-flashcodeinstall/test
+ * g++ -std=c++20 -Wall -Wextra -Werror -DNDEBUG -DGD32 -DGD32F10X -DBOARD_GD32F107RC -I. -I../include -I../../lib-flashcode/include -I../../common/include -I../../include \
+ *     test_activate.cpp ../src/lz4decoder.cpp ../src/firmwarepatch.cpp ../src/firmwaretrailer.cpp ../../lib-clib/src/crc32/crc32.cpp -o test_activate && ./test_activate
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+namespace test
+{
+static constexpr uint32_t kFlashSize = 256 * 1024;
+static constexpr uint32_t kSectorSize = 4096;
+static uint8_t s_flash[kFlashSize] __attribute__((aligned(4)));
+static uint32_t s_erased;
+} // namespace test
+
+#define FLASH_BASE reinterpret_cast<uintptr_t>(test::s_flash)
+
+#include "../src/flashcodeinstall.cpp"
+
+FlashCode::FlashCode() {}
+
+FlashCode::~FlashCode() {}
+
+const char* FlashCode::GetName() const
+{
+    return "RAM";
+}
+
+uint32_t FlashCode::GetSize() const
+{
+    return test::kFlashSize;
+}
+
+uint32_t FlashCode::GetSectorSize() const
+{
+    return test::kSectorSize;
+}
+
+namespace firmware::update
+{
+void SetSectors([[maybe_unused]] uint32_t written, [[maybe_unused]] uint32_t skipped) {}
+} // namespace firmware::update
+
+/*
+ * The jobs are done at submission.
+ */
+namespace flashcode::jobs
+{
+bool Submit(Type type, uint32_t offset, uint32_t length, const uint8_t* buffer, Callback done, Callback progress, void* context)
+{
+    Job job{type, offset, length, buffer, done, progress, context, length, 0, Result::kOk};
+
+    if ((offset + length) > test::kFlashSize)
+    {
+        job.result = Result::kError;
+    }
+    else if (Type::kErase == type)
+    {
+        memset(&test::s_flash[offset], 0xFF, length);
+        test::s_erased += length / test::kSectorSize;
+    }
+    else if (Type::kProgram == type)
+    {
+        // Programming can only clear bits
+        for (uint32_t i = 0; i < length; i++)
+        {
+            test::s_flash[offset + i] &= buffer[i];
+        }
+    }
+    else if (Type::kCrc == type)
+    {
+        job.crc = crc32(0, &test::s_flash[offset], length);
+    }
+
+    if (done != nullptr)
+    {
+        done(job);
+    }
+
+    return true;
+}
+
+uint32_t Pending()
+{
+    return 0;
+}
+
+void Flush() {}
+} // namespace flashcode::jobs
+
+FlashCodeInstall::FlashCodeInstall()
+{
+    s_this = this;
+    flash_size_ = FlashCode::GetSize();
+}
+
+FlashCodeInstall::~FlashCodeInstall()
+{
+    s_this = nullptr;
+}
+
+namespace test
+{
+static constexpr uint32_t kImageLength = 5 * kSectorSize + 200; ///< Without the trailer
+static constexpr uint32_t kImageSize = kImageLength + sizeof(struct firmware::trailer::Trailer);
+static uint8_t s_image[kImageSize] __attribute__((aligned(4)));
+
+/*
+ * Writes an image with its trailer and boot record in a slot.
+ */
+static void MakeSlot(uint32_t offset, uint8_t seed)
+{
+    for (uint32_t i = 0; i < kImageLength; i++)
+    {
+        s_image[i] = static_cast<uint8_t>(i * 7 + seed);
+    }
+
+    firmware::trailer::Trailer trailer;
+    trailer.magic = firmware::trailer::kMagic;
+    trailer.length = kImageLength;
+    trailer.crc = 0;
+    memcpy(&s_image[kImageLength], &trailer, sizeof(trailer));
+    // The crc covers the image, the magic and the length
+    trailer.crc = crc32(0, s_image, kImageLength + 8);
+    memcpy(&s_image[kImageLength], &trailer, sizeof(trailer));
+
+    memset(&s_flash[offset], 0xFF, FIRMWARE_MAX_SIZE);
+    memcpy(&s_flash[offset], s_image, kImageSize);
+
+    firmware::trailer::Record record;
+    firmware::trailer::MakeRecord(&s_flash[offset], kImageSize, FIRMWARE_MAX_SIZE, record);
+    memcpy(&s_flash[offset + FIRMWARE_MAX_SIZE - sizeof(record)], &record, sizeof(record));
+}
+
+static int s_failed;
+
+static void Check(bool condition, const char* text)
+{
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", text);
+
+    if (!condition)
+    {
+        s_failed++;
+    }
+}
+} // namespace test
+
+int main()
+{
+    FlashCodeInstall install;
+
+    // Slot A holds the same image as slot B, except for the second sector
+    memset(test::s_flash, 0xFF, sizeof(test::s_flash));
+    test::MakeSlot(OFFSET_UIMAGE, 1);
+    test::MakeSlot(OFFSET_SLOT_B, 1);
+    test::s_flash[OFFSET_UIMAGE + test::kSectorSize + 10] ^= 0x55;
+
+    test::Check(firmware::trailer::IsVerified(&test::s_flash[OFFSET_SLOT_B], FIRMWARE_MAX_SIZE), "slot B is verified");
+
+    test::s_erased = 0;
+
+    test::Check(install.ActivateSlot(), "ActivateSlot");
+    test::Check(memcmp(&test::s_flash[OFFSET_UIMAGE], &test::s_flash[OFFSET_SLOT_B], test::kImageSize) == 0, "slot A content");
+    // The sector that differs, and the sectors of the boot records of slot A and slot B
+    test::Check(test::s_erased == 3, "only the sectors that differ are erased");
+    test::Check(firmware::trailer::IsVerified(&test::s_flash[OFFSET_UIMAGE], FIRMWARE_MAX_SIZE), "slot A is verified");
+    test::Check(!firmware::trailer::IsVerified(&test::s_flash[OFFSET_SLOT_B], FIRMWARE_MAX_SIZE), "slot B is no longer marked");
+
+    // A different image in slot B, all its sectors are copied
+    test::MakeSlot(OFFSET_SLOT_B, 2);
+    test::s_erased = 0;
+
+    test::Check(install.ActivateSlot(), "ActivateSlot of a different image");
+    test::Check(memcmp(&test::s_flash[OFFSET_UIMAGE], &test::s_flash[OFFSET_SLOT_B], test::kImageSize) == 0, "slot A content");
+    test::Check(test::s_erased == (test::kImageSize + test::kSectorSize - 1) / test::kSectorSize + 2, "all sectors of the image are erased");
+
+    return test::s_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file test_prepare.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host test of the streaming install, with the flash and the flash job queue in RAM.
+ * A GD32F4xx board is used, where the firmware area is erased in advance by Prepare.
+ *
+ * cd lib-flashcodeinstall/test
+ * g++ -std=c++20 -Wall -Wextra -Werror -DNDEBUG -DGD32 -DBOARD_GD32F407RE -I. -I../include -I../../lib-flashcode/include -I../../common/include \
+ *     test_prepare.cpp ../src/lz4decoder.cpp ../src/firmwarepatch.cpp -o test_prepare && ./test_prepare
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace test
+{
+static constexpr uint32_t kFlashSize = 512 * 1024;
+static constexpr uint32_t kSectorSize = 4096;
+static uint8_t s_flash[kFlashSize] __attribute__((aligned(4)));
+} // namespace test
+
+#define FLASH_BASE reinterpret_cast<uintptr_t>(test::s_flash)
+
+#include "../src/flashcodeinstall.cpp"
+
+FlashCode::FlashCode() {}
+
+FlashCode::~FlashCode() {}
+
+const char* FlashCode::GetName() const
+{
+    return "RAM";
+}
+
+uint32_t FlashCode::GetSize() const
+{
+    return test::kFlashSize;
+}
+
+uint32_t FlashCode::GetSectorSize() const
+{
+    return test::kSectorSize;
+}
+
+/*
+ * The jobs are done at submission.
+ */
+namespace flashcode::jobs
+{
+bool Submit(Type type, uint32_t offset, uint32_t length, const uint8_t* buffer, Callback done, Callback progress, void* context)
+{
+    Job job{type, offset, length, buffer, done, progress, context, length, 0, Result::kOk};
+
+    if ((offset + length) > test::kFlashSize)
+    {
+        job.result = Result::kError;
+    }
+    else if (Type::kErase == type)
+    {
+        memset(&test::s_flash[offset], 0xFF, length);
+    }
+    else if (Type::kProgram == type)
+    {
+        // Programming can only clear bits
+        for (uint32_t i = 0; i < length; i++)
+        {
+            test::s_flash[offset + i] &= buffer[i];
+        }
+    }
+
+    if (done != nullptr)
+    {
+        done(job);
+    }
+
+    return true;
+}
+
+uint32_t Pending()
+{
+    return 0;
+}
+
+void Flush() {}
+} // namespace flashcode::jobs
+
+FlashCodeInstall::FlashCodeInstall()
+{
+    s_this = this;
+    flash_size_ = FlashCode::GetSize();
+}
+
+FlashCodeInstall::~FlashCodeInstall()
+{
+    s_this = nullptr;
+}
+
+namespace test
+{
+static constexpr uint32_t kImageSize = 3 * kSectorSize + 100;
+static uint8_t s_image[kImageSize];
+static uint8_t s_frame[128];
+
+static void Put32(uint8_t*& p, uint32_t value)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        *p++ = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+/*
+ * An LZ4 frame of a single block, 16 literals repeated by a long match, followed by 8 literals.
+ */
+static uint32_t MakeFrame()
+{
+    static constexpr uint32_t kLiterals = 16;
+    static constexpr uint32_t kLastLiterals = 8;
+    static constexpr uint32_t kMatch = kImageSize - kLiterals - kLastLiterals;
+
+    for (uint32_t i = 0; i < kImageSize; i++)
+    {
+        s_image[i] = static_cast<uint8_t>((i % kLiterals) * 7 + 1);
+    }
+
+    uint8_t block[sizeof(s_frame)];
+    auto* p = block;
+
+    *p++ = 0xFF; // 15 + literals, 15 + 4 + match
+    *p++ = static_cast<uint8_t>(kLiterals - 15);
+    memcpy(p, s_image, kLiterals);
+    p += kLiterals;
+    *p++ = static_cast<uint8_t>(kLiterals);
+    *p++ = 0;
+
+    auto remaining = kMatch - 4 - 15;
+
+    while (remaining >= 255)
+    {
+        *p++ = 255;
+        remaining -= 255;
+    }
+
+    *p++ = static_cast<uint8_t>(remaining);
+    *p++ = static_cast<uint8_t>(kLastLiterals << 4);
+    memcpy(p, &s_image[kImageSize - kLastLiterals], kLastLiterals);
+    p += kLastLiterals;
+
+    const auto kBlockSize = static_cast<uint32_t>(p - block);
+
+    p = s_frame;
+    Put32(p, firmware::lz4::kMagic);
+    *p++ = 0x60; // Version 01, independent blocks
+    *p++ = 0x40; // 64 KB blocks
+    *p++ = 0x82; // Header checksum, not checked
+    Put32(p, kBlockSize);
+    memcpy(p, block, kBlockSize);
+    p += kBlockSize;
+    Put32(p, 0); // End mark
+
+    return static_cast<uint32_t>(p - s_frame);
+}
+
+static int s_failed;
+
+static void Check(bool condition, const char* text)
+{
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", text);
+
+    if (!condition)
+    {
+        s_failed++;
+    }
+}
+} // namespace test
+
+int main()
+{
+    const auto kFrameSize = test::MakeFrame();
+
+    FlashCodeInstall install;
+
+    memset(test::s_flash, 0, sizeof(test::s_flash));
+
+    install.StreamBegin();
+
+    // The announced size is the maximum, the compressed stream asks again for the maximum
+    test::Check(install.Prepare(FIRMWARE_MAX_SIZE), "Prepare(FIRMWARE_MAX_SIZE)");
+    test::Check(install.StreamWrite(test::s_frame, kFrameSize), "StreamWrite of the LZ4 frame");
+    test::Check(install.StreamEnd(), "StreamEnd");
+    test::Check(install.GetImageSize() == test::kImageSize, "image size");
+    test::Check(memcmp(&test::s_flash[OFFSET_UIMAGE], test::s_image, test::kImageSize) == 0, "flash content");
+
+    return test::s_failed == 0 ? 0 : 1;
+}
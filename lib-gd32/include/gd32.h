@@ -103,6 +103,12 @@ uint16_t bkp_data_read(bkp_data_register_enum register_number);
 #define GPIO_OSPEED GPIO_OSPEED_50MHZ
 #endif
 
+/*
+ * Code that must keep running while the flash is busy, the section is copied to RAM together with .data.
+ * No library code in flash can be called from here.
+ */
+#define RAMFUNC __attribute__((section(".ramfunc"), long_call, noinline, optimize("no-tree-loop-distribute-patterns")))
+
 #define GD32_PORT_TO_GPIO(p, n) ((p * 16) + n)
 #define GD32_GPIO_TO_PORT(g) (uint8_t)(g / 16)
 #define GD32_GPIO_TO_NUMBER(g) (uint8_t)(g - (16 * GD32_GPIO_TO_PORT(g)))
@@ -26,8 +26,31 @@
 #ifndef NET_CONFIG_H_
 #define NET_CONFIG_H_
 
+/*
+ * Concurrent TFTP transfers, each session uses its own UDP port next to port 69.
+ */
+#if !defined (TFTP_MAX_SESSIONS)
+# define TFTP_MAX_SESSIONS				2
+#endif
+
+/*
+ * The UDP ports of the TFTP server: port 69, a port per session and the RFC 2090 multicast port.
+ * CONFIG_UDP_PORTS_MINIMUM sizes the port table for these, DHCP and remote configuration only.
+ */
+#if defined (CONFIG_TFTP_MULTICAST)
+# define UDP_PORTS_TFTP					(2 + TFTP_MAX_SESSIONS)
+#else
+# define UDP_PORTS_TFTP					(1 + TFTP_MAX_SESSIONS)
+#endif
+
+#if defined (CONFIG_UDP_PORTS_MINIMUM) && !defined (UDP_MAX_PORTS_ALLOWED)
+# define UDP_MAX_PORTS_ALLOWED			(2 + UDP_PORTS_TFTP)
+#endif
+
 #if defined(__linux__) || defined (__APPLE__)
-# define UDP_MAX_PORTS_ALLOWED			32
+# if !defined (UDP_MAX_PORTS_ALLOWED)
+#  define UDP_MAX_PORTS_ALLOWED			32
+# endif
 # define IGMP_MAX_JOINS_ALLOWED			(4 + (8 * 4)) /* 8 outputs x 4 Universes */
 # define TCP_MAX_TCBS_ALLOWED			16
 # define TCP_MAX_PORTS_ALLOWED			2
@@ -37,7 +60,9 @@
 #  if !defined(HOST_NAME_PREFIX)
 #   define HOST_NAME_PREFIX				"allwinner_"
 #  endif
-#  define UDP_MAX_PORTS_ALLOWED			16
+#  if !defined (UDP_MAX_PORTS_ALLOWED)
+#   define UDP_MAX_PORTS_ALLOWED		16
+#  endif
 #  define IGMP_MAX_JOINS_ALLOWED		(4 + (8 * 4)) /* 8 outputs x 4 Universes */
 #  define TCP_MAX_TCBS_ALLOWED			16
 # elif defined (GD32)
@@ -62,6 +87,39 @@
 # endif
 #endif
 
+/*
+ * RFC 7440: a TFTP window arrives as a burst, which must fit in the Ethernet RX descriptors.
+ */
+#if !defined (TFTP_MAX_WINDOWSIZE)
+# if defined (ENET_RXBUF_NUM)
+#  define TFTP_MAX_WINDOWSIZE			ENET_RXBUF_NUM
+# else
+#  define TFTP_MAX_WINDOWSIZE			4
+# endif
+#endif
+
+/*
+ * The polled UDP ports without a receive queue, each keeps its own datagram.
+ * DHCP Inform is the only one in the tree.
+ */
+#if !defined (UDP_MAX_POLLED_PORTS)
+# define UDP_MAX_POLLED_PORTS			1
+#endif
+
+/*
+ * The deepest receive queue of a polled UDP port, see network::udp::Begin.
+ */
+#if !defined (UDP_MAX_QUEUE_DEPTH)
+# define UDP_MAX_QUEUE_DEPTH			4
+#endif
+
+/*
+ * Connected UDP sends, see network::udp::Connect.
+ */
+#if !defined (UDP_MAX_CONNECTIONS)
+# define UDP_MAX_CONNECTIONS			4
+#endif
+
 #if !defined (UDP_MAX_PORTS_ALLOWED)
 # error
 #endif
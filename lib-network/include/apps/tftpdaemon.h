@@ -29,6 +29,11 @@
 #include <cstdint>
 #include <cstddef>
 
+#include "net_config.h"
+#include "softwaretimers.h"
+
+class TFTPDaemon;
+
 namespace tftp
 {
 enum class Mode
@@ -36,62 +41,167 @@ enum class Mode
     kBinary,
     kAscii
 };
-} // namespace tftp
 
-class TFTPDaemon
+/*
+ * Counted over all sessions, since the daemon was started.
+ */
+struct Statistics
+{
+    uint32_t retransmits;  ///< Timeouts that sent a packet again
+    uint32_t out_of_order; ///< DATA blocks that were missing or received again
+};
+
+/*
+ * A single transfer, identified by the IP address and port of the peer.
+ * Each session has its own state, buffers and local port (transfer ID).
+ */
+class Session
 {
    public:
-    TFTPDaemon();
-    virtual ~TFTPDaemon();
+    void Init(TFTPDaemon* daemon, uint32_t id);
 
-    void Input(const uint8_t*, uint32_t, uint32_t, uint16_t);
+    bool IsFree() const { return state_ == State::kFree; }
+    bool IsPeer(uint32_t from_ip, uint16_t from_port) const;
 
-    virtual bool FileOpen(const char* file_name, tftp::Mode mode) = 0;
-    virtual bool FileCreate(const char* file_name, tftp::Mode mode) = 0;
-    virtual bool FileClose() = 0;
-    virtual size_t FileRead(void* buffer, size_t count, unsigned block_number) = 0;
-    virtual size_t FileWrite(const void* buffer, size_t count, unsigned block_number) = 0;
+    void Request(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port);
+    void Input(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port);
+    void Timer();
+    void Close();
 
-    virtual void Exit() = 0;
+#if defined(CONFIG_TFTP_MULTICAST)
+    bool MulticastRequest(uint32_t server_ip, const char* file_name);
+    bool IsMulticast() const { return server_ip_ != 0; }
+#endif
 
    private:
-    void Init();
+    bool Begin();
+    void End();
     void HandleRequest();
+    uint32_t HandleOptions(const char* options, const char* end, char* oack);
     void HandleRecvAck();
     void HandleRecvData();
     void SendError(uint16_t error_code, const char* error_message);
     void DoRead();
     void DoWriteAck();
+    void SendOptionAck();
+    void Progress();
+    void Retransmit();
+    void Abort();
+#if defined(CONFIG_TFTP_MULTICAST)
+    void HandleMulticast();
+    void HandleMulticastOack();
+    void HandleMulticastData();
+    void SendMulticastRequest();
+    void SendMulticastAck();
+    void MulticastEnd();
+#endif
 
    private:
     enum class State
     {
-        kInit,
-        kWaitingRq,
+        kFree,
         kRrqSendPacket,
         kRrqRecvAck,
         kWrqSendAck,
-        kWrqRecvPacket
+        kWrqRecvPacket,
+        kWrqDally, ///< The last block is acknowledged, the ACK is sent again when it is lost
+        kMrqRecvOack,
+        kMrqRecvData,
+        kMrqDone
     };
-    State state_{State::kInit};
+    State state_{State::kFree};
+    TFTPDaemon* daemon_{nullptr};
+    uint32_t id_{0};
     int32_t index_{-1};
+    int32_t connection_{-1}; ///< RRQ, the data packets go to the same peer
     uint8_t* buffer_{nullptr};
     uint32_t from_ip_{0};
     uint32_t length_{0};
     uint32_t data_length_{0};
     uint32_t packet_length_{0};
+    uint32_t block_size_{0};
+    uint32_t window_size_{0};
+    uint32_t window_count_{0};
+    uint32_t out_of_order_count_{0};
+    uint32_t transfer_size_{0};
+    uint32_t oack_length_{0};
+    uint32_t timeout_millis_{0};
+    uint32_t activity_millis_{0};
+    uint32_t retries_{0};
+    uint16_t port_{0};
     uint16_t from_port_{0};
     uint16_t block_number_{0};
     bool is_last_block_{false};
+    bool has_transfer_size_{false};
+#if defined(CONFIG_TFTP_MULTICAST)
+    uint32_t server_ip_{0};
+    uint32_t multicast_ip_{0};
+    uint32_t request_length_{0};
+    int32_t multicast_index_{-1};
+    uint16_t multicast_port_{0};
+    bool is_master_client_{false};
+#endif
+};
+} // namespace tftp
+
+/*
+ * Port 69 stays open, a request is served by a free session from the pool.
+ * The session is passed to the file callbacks, so that each transfer can have its own file.
+ */
+class TFTPDaemon
+{
+   public:
+    TFTPDaemon();
+    virtual ~TFTPDaemon();
+
+    void Input(const uint8_t*, uint32_t, uint32_t, uint16_t);
+
+    virtual bool FileOpen(uint32_t session, const char* file_name, tftp::Mode mode) = 0;
+    virtual bool FileCreate(uint32_t session, const char* file_name, tftp::Mode mode) = 0;
+    virtual bool FileClose(uint32_t session) = 0;
+    /// The transfer did not complete, the file is discarded
+    virtual void FileAbort(uint32_t session) = 0;
+    /// The transfer size announced with a WRQ, return false when the file does not fit
+    virtual bool FileAllocate(uint32_t session, uint32_t file_size) = 0;
+    /// The size of the file opened for a RRQ
+    virtual uint32_t FileSize(uint32_t session) = 0;
+    virtual size_t FileRead(uint32_t session, void* buffer, size_t count, unsigned block_number, size_t block_size) = 0;
+    virtual size_t FileWrite(uint32_t session, const void* buffer, size_t count, unsigned block_number, size_t block_size) = 0;
+
+    virtual void Exit() = 0;
+
+#if defined(CONFIG_TFTP_MULTICAST)
+    /*
+     * RFC 2090: the file is read from a multicast TFTP server, together with the other nodes.
+     * It is received with FileCreate, FileWrite and FileClose, as with a WRQ.
+     */
+    bool MulticastRequest(uint32_t server_ip, const char* file_name);
+#endif
+
+    const tftp::Statistics& GetStatistics() const { return statistics_; }
 
     static TFTPDaemon* Get() { return s_this; }
 
+   private:
+    void SendError(uint32_t to_ip, uint16_t to_port, uint16_t error_code, const char* error_message);
+    void TimerStart();
+    void Timer();
+
+   private:
+    tftp::Session sessions_[TFTP_MAX_SESSIONS];
+    int32_t index_{-1};
+    TimerHandle_t timer_id_{kTimerIdNone};
+    tftp::Statistics statistics_{};
+
    private:
     void static StaticCallbackFunction(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port)
     {
         s_this->Input(buffer, size, from_ip, from_port);
     }
+    void static StaticTimerFunction([[maybe_unused]] TimerHandle_t handle) { s_this->Timer(); }
     static inline TFTPDaemon* s_this;
+
+    friend class tftp::Session;
 };
 
 #endif  // APPS_TFTPDAEMON_H_
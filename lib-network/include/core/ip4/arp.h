@@ -43,6 +43,15 @@ void Send(void*, const uint32_t, uint32_t);
 #if defined CONFIG_NET_ENABLE_PTP
 void SendTimestamp(void*, uint32_t, uint32_t);
 #endif
+/*
+ * The MAC address for a remote address from the cache, the gateway when it is not on the local network.
+ * Returns false when it is not known yet, Send then resolves it.
+ */
+bool Lookup(uint32_t remote_ip, uint8_t* mac_address);
+/*
+ * Changes whenever a MAC address in the cache is learned, changed or no longer used.
+ */
+uint32_t Generation();
 void AcdProbe(ip4_addr_t ipaddr);
 void AcdSendAnnouncement(ip4_addr_t ipaddr);
 
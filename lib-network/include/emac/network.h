@@ -46,6 +46,7 @@
 #endif
 
 uint32_t emac_eth_recv(uint8_t**);
+void emac_eth_recv_ram();
 
 namespace network
 {
@@ -32,11 +32,60 @@ namespace network::udp
 {
 typedef void (*UdpCallbackFunctionPtr)(const uint8_t*, uint32_t, uint32_t, uint16_t);
 
-int32_t Begin(uint16_t, UdpCallbackFunctionPtr callback);
+/*
+ * With kZeroCopy the callback gets the payload in the receive DMA buffer.
+ * It is valid until the callback returns, or until the callback calls Release.
+ * With kCopy the buffer is released first, for a callback that waits a long time,
+ * or that needs what is done when the buffer is released (PTP receive timestamp).
+ * A port without callback is polled with Recv, the datagram is always copied.
+ */
+enum class Delivery
+{
+    kZeroCopy,
+    kCopy
+};
+
+/*
+ * A polled port keeps a single datagram, a new one replaces it.
+ * Each has a slot of its own, at most UDP_MAX_POLLED_PORTS ports are polled without a queue depth.
+ * With a queue depth, up to that many datagrams are kept, in blocks from network::memory::Allocator.
+ * The data returned by Recv is valid until the next Recv or End.
+ */
+int32_t Begin(uint16_t, UdpCallbackFunctionPtr callback, Delivery delivery = Delivery::kZeroCopy, uint32_t queue_depth = 0);
 int32_t End(uint16_t);
 uint32_t Recv(const int32_t, const uint8_t**, uint32_t*, uint16_t*);
+/*
+ * The datagrams of a polled port that were replaced or dropped, as the queue or the pool was full.
+ */
+uint32_t GetOverflows(int32_t index);
 void Send(int32_t, const uint8_t*, uint32_t, uint32_t, uint16_t);
 void SendWithTimestamp(int32_t, const uint8_t*, uint32_t, uint32_t, uint16_t);
+/*
+ * Two-phase send, the payload is written straight into the transmit DMA buffer.
+ * AcquireTx returns the payload area, for at most max_length bytes (kDataSize).
+ * CommitTx fills in the headers and starts the DMA. Nothing else may be sent in between,
+ * so the payload must not be built by code that sends, or that waits for the flash.
+ */
+uint8_t* AcquireTx(int32_t index, uint32_t max_length);
+void CommitTx(uint32_t length, uint32_t remote_ip, uint16_t remote_port);
+/*
+ * Connected send, for repeated sends from a port to the same peer.
+ * The headers are built once, with the MAC address from the ARP cache, and are copied per send.
+ * They are built again after a change in the ARP cache, or of the local address.
+ * Connect returns -1 when all connections are in use, End of the port disconnects.
+ */
+int32_t Connect(int32_t index, uint32_t remote_ip, uint16_t remote_port);
+void Disconnect(int32_t connection);
+void SendConnected(int32_t connection, const uint8_t* data, uint32_t size);
+/*
+ * As CommitTx, after AcquireTx with the port index of the connection.
+ */
+void CommitTxConnected(int32_t connection, uint32_t length);
+/*
+ * Hands the receive buffer back to the DMA, from within a kZeroCopy callback.
+ * The payload must not be used after it.
+ */
+void Release();
 } // namespace net::udp
 
 #endif // NETWORK_UDP_H_
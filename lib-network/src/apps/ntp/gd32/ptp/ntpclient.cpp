@@ -573,7 +573,8 @@ void Start()
         return;
     }
 
-    s_ntp_client.handle = network::udp::Begin(network::iana::Ports::kPortNtp, Input);
+    // The receive timestamp is taken from the descriptor when the buffer is released
+    s_ntp_client.handle = network::udp::Begin(network::iana::Ports::kPortNtp, Input, network::udp::Delivery::kCopy);
     assert(s_ntp_client.handle != -1);
 
     s_ntp_client.status = ntp::Status::kIdle;
@@ -25,6 +25,11 @@
 
 /*
  * https://tools.ietf.org/html/rfc1350
+ * https://tools.ietf.org/html/rfc2090 Multicast Option
+ * https://tools.ietf.org/html/rfc2347 Option Extension
+ * https://tools.ietf.org/html/rfc2348 Blocksize Option
+ * https://tools.ietf.org/html/rfc2349 Timeout Interval and Transfer Size Options
+ * https://tools.ietf.org/html/rfc7440 Windowsize Option
  */
 
 #if defined(DEBUG_NET_APPS_TFTP)
@@ -33,11 +38,21 @@
 
 #include <cstdint>
 #include <cstring>
+#include <cctype>
+#include <cstdio>
 #include <cassert>
 
 #include "network.h"
+#include "net_config.h"
 #include "apps/tftpdaemon.h"
 #include "core/protocol/iana.h"
+#include "core/protocol/udp.h"
+#if defined(CONFIG_TFTP_MULTICAST)
+#include "network_igmp.h"
+#include "ip4/ip4_helpers.h"
+#endif
+#include "softwaretimers.h"
+#include "hal_millis.h"
 #include "firmware/debug/debug_debug.h"
 
 static constexpr uint16_t kOpCodeRrq = 1;   ///< Read request (RRQ)
@@ -45,6 +60,7 @@ static constexpr uint16_t kOpCodeWrq = 2;   ///< Write request (WRQ)
 static constexpr uint16_t kOpCodeData = 3;  ///< Data (DATA)
 static constexpr uint16_t kOpCodeAck = 4;   ///< Acknowledgment (ACK)
 static constexpr uint16_t kOpCodeError = 5; ///< Error (ERROR)
+static constexpr uint16_t kOpCodeOack = 6;  ///< Option Acknowledgment (OACK)
 
 static constexpr uint16_t kErrorCodeOther = 0;    ///< Not defined, see error message (if any).
 static constexpr uint16_t kErrorCodeNoFile = 1;   ///< File not found.
@@ -57,18 +73,31 @@ static constexpr uint16_t kErrorCodeIllOper = 4;  ///< Illegal TFTP operation.
 
 namespace tftp
 {
+static constexpr uint32_t kBlockSize = 512;        ///< RFC 1350 block size, used when no blksize option is negotiated
+static constexpr uint32_t kTimeoutMillis = 250;    ///< Retransmission timeout, used when no timeout option is negotiated
+static constexpr uint32_t kTimerIntervalMillis = 20;
+static constexpr uint32_t kRetries = 5;            ///< Retransmissions before the transfer is aborted
+static constexpr uint16_t kSessionPortBase = 49152; ///< The transfer ID of a session is kSessionPortBase + session
+
 namespace min
 {
 static constexpr uint32_t kFilenameModeLen = (1 + 1 + 1 + 1);
-}
+static constexpr uint32_t kBlockSize = 8;
+static constexpr uint32_t kWindowSize = 1;
+static constexpr uint32_t kTimeout = 1;
+} // namespace min
 
 namespace max
 {
 static constexpr uint32_t kFilenameLen = 128;
 static constexpr uint32_t kModeLen = 16;
 static constexpr uint32_t kFilenameModeLen = (kFilenameLen + 1 + kModeLen + 1);
-static constexpr uint32_t kDataLen = 512;
+static constexpr uint32_t kBlockSize = network::udp::kDataSize - 4; ///< A DATA packet must fit in a single Ethernet frame
+static constexpr uint32_t kWindowSize = TFTP_MAX_WINDOWSIZE;
+static constexpr uint32_t kTimeout = 255;
+static constexpr uint32_t kTimeoutMillis = 4000; ///< Upper bound of the exponential backoff
 static constexpr uint32_t kErrmsgLen = 128;
+static constexpr uint32_t kOptionsLen = 64;
 } // namespace max
 
 #if !defined(PACKED)
@@ -98,121 +127,438 @@ struct DataPacket
 {
     uint16_t op_code;
     uint16_t block_number;
-    uint8_t data[max::kDataLen];
+    uint8_t data[max::kBlockSize];
 } PACKED;
-} // namespace tftp
 
-TFTPDaemon::TFTPDaemon()
+struct OackPacket
 {
-    DEBUG_ENTRY();
-    DEBUG_PRINTF("s_this=%p", reinterpret_cast<void*>(s_this));
+    uint16_t op_code;
+    char options[max::kOptionsLen];
+} PACKED;
 
-    if (s_this != nullptr)
+/*
+ * Returns the terminating '\0' of the string, or nullptr when it is not terminated before end.
+ */
+static const char* StringEnd(const char* string, const char* end)
+{
+    while (string < end)
     {
-        s_this->Exit();
+        if (*string == '\0')
+        {
+            return string;
+        }
+        string++;
     }
 
-    s_this = this;
+    return nullptr;
+}
+
+static bool GetValue(const char* value, uint32_t& result)
+{
+    if (*value == '\0')
+    {
+        return false;
+    }
 
-    Init();
+    result = 0;
 
-    DEBUG_PRINTF("s_this=%p", reinterpret_cast<void*>(s_this));
-    DEBUG_EXIT();
+    while (*value != '\0')
+    {
+        if ((!isdigit(*value)) || (result > 0xFFFFFF))
+        {
+            return false;
+        }
+        result = (result * 10) + static_cast<uint32_t>(*value - '0');
+        value++;
+    }
+
+    return true;
 }
 
-TFTPDaemon::~TFTPDaemon()
+static uint32_t AddOption(char* oack, uint32_t length, const char* name, uint32_t value)
 {
-    DEBUG_ENTRY();
-    DEBUG_PRINTF("s_this=%p", reinterpret_cast<void*>(s_this));
+    const auto kNameLength = static_cast<uint32_t>(strlen(name)) + 1;
 
-    network::udp::End(from_port_);
+    if ((length + kNameLength) >= max::kOptionsLen)
+    {
+        return length;
+    }
 
-    s_this = nullptr;
+    memcpy(&oack[length], name, kNameLength);
 
-    DEBUG_EXIT();
+    const auto kValueLength = snprintf(&oack[length + kNameLength], max::kOptionsLen - length - kNameLength, "%u", static_cast<unsigned int>(value));
+
+    if ((kValueLength <= 0) || ((length + kNameLength + static_cast<uint32_t>(kValueLength) + 1) > max::kOptionsLen))
+    {
+        return length;
+    }
+
+    return length + kNameLength + static_cast<uint32_t>(kValueLength) + 1;
 }
 
-void TFTPDaemon::Init()
+static OackPacket s_oack_packet[TFTP_MAX_SESSIONS]; ///< Kept for retransmission
+
+#if defined(CONFIG_TFTP_MULTICAST)
+struct MulticastReqPacket
 {
-    DEBUG_ENTRY();
-    assert(state_ == State::kInit);
+    uint16_t op_code;
+    char file_name_mode[max::kFilenameModeLen + max::kOptionsLen];
+} PACKED;
+
+static MulticastReqPacket s_multicast_request; ///< Kept for retransmission
+
+/*
+ * RFC 2090: the value is "addr,port,mc". The address and port can be empty in a subsequent OACK.
+ */
+static bool GetMulticast(const char* value, uint32_t& ip, uint16_t& port, bool& is_master_client)
+{
+    const auto* const kPortValue = strchr(value, ',');
 
-    if (from_port_ != 0)
+    if (kPortValue == nullptr)
     {
-        network::udp::End(from_port_);
-        index_ = -1;
+        return false;
     }
 
-    index_ = network::udp::Begin(network::iana::Ports::kPortTftp, TFTPDaemon::StaticCallbackFunction);
-    DEBUG_PRINTF("index_=%d", index_);
+    const auto* const kMasterValue = strchr(kPortValue + 1, ',');
 
-    from_port_ = network::iana::Ports::kPortTftp;
+    if (kMasterValue == nullptr)
+    {
+        return false;
+    }
+
+    if (kPortValue != value)
+    {
+        ip = net::ParseIpString(value, static_cast<uint32_t>(kPortValue - value));
+    }
+
+    if (kMasterValue != (kPortValue + 1))
+    {
+        uint32_t result = 0;
+
+        for (const auto* digit = kPortValue + 1; digit < kMasterValue; digit++)
+        {
+            if ((!isdigit(*digit)) || (result > 0xFFFF))
+            {
+                return false;
+            }
+            result = (result * 10) + static_cast<uint32_t>(*digit - '0');
+        }
+
+        if ((result == 0) || (result > 0xFFFF))
+        {
+            return false;
+        }
+
+        port = static_cast<uint16_t>(result);
+    }
+
+    is_master_client = (kMasterValue[1] == '1');
+
+    return true;
+}
+#endif
+
+void Session::Init(TFTPDaemon* daemon, uint32_t id)
+{
+    daemon_ = daemon;
+    id_ = id;
+    port_ = static_cast<uint16_t>(kSessionPortBase + id);
+    state_ = State::kFree;
+}
+
+bool Session::IsPeer(uint32_t from_ip, uint16_t from_port) const
+{
+    if ((state_ == State::kFree) || (from_ip != from_ip_))
+    {
+        return false;
+    }
+
+#if defined(CONFIG_TFTP_MULTICAST)
+    // The server answers the request from its own transfer ID
+    if (state_ == State::kMrqRecvOack)
+    {
+        return true;
+    }
+#endif
+
+    return from_port == from_port_;
+}
+
+/*
+ * The transfer ID of this session, returns false when the UDP port table is full.
+ */
+bool Session::Begin()
+{
+    // FileWrite can wait for the flash, meanwhile the receive buffer must be free for ARP and ping
+    index_ = network::udp::Begin(port_, TFTPDaemon::StaticCallbackFunction, network::udp::Delivery::kCopy);
+    DEBUG_PRINTF("id_=%u, port_=%u, index_=%d", id_, port_, index_);
+
+    if (index_ < 0)
+    {
+        return false;
+    }
+
+    block_size_ = kBlockSize;
+    window_size_ = min::kWindowSize;
+    window_count_ = 0;
+    out_of_order_count_ = 0;
+    oack_length_ = 0;
+    timeout_millis_ = kTimeoutMillis;
     block_number_ = 0;
-    state_ = State::kWaitingRq;
     is_last_block_ = false;
+    has_transfer_size_ = false;
+    retries_ = 0;
+    activity_millis_ = hal::Millis();
+
+    daemon_->TimerStart();
+
+    return true;
+}
+
+void Session::End()
+{
+    DEBUG_PRINTF("id_=%u, port_=%u", id_, port_);
+
+#if defined(CONFIG_TFTP_MULTICAST)
+    MulticastEnd();
+#endif
+
+    if (connection_ >= 0)
+    {
+        network::udp::Disconnect(connection_);
+        connection_ = -1;
+    }
+
+    network::udp::End(port_);
+    index_ = -1;
+    state_ = State::kFree;
+}
+
+/*
+ * Called from the destructor of the daemon, the file callbacks are no longer available.
+ */
+void Session::Close()
+{
+    if (state_ != State::kFree)
+    {
+        End();
+    }
+}
+
+void Session::Timer()
+{
+    if (state_ == State::kWrqDally)
+    {
+        // The longest the client waits before it sends the last block again
+        const auto kDallyMillis = timeout_millis_ > max::kTimeoutMillis ? timeout_millis_ : max::kTimeoutMillis;
+
+        if ((hal::Millis() - activity_millis_) >= kDallyMillis)
+        {
+            End();
+        }
+        return;
+    }
+
+    if ((state_ != State::kRrqRecvAck) && (state_ != State::kWrqRecvPacket)
+#if defined(CONFIG_TFTP_MULTICAST)
+        && (state_ != State::kMrqRecvOack) && (state_ != State::kMrqRecvData) && (state_ != State::kMrqDone)
+#endif
+    )
+    {
+        return;
+    }
+
+    // Exponential backoff, bounded unless the negotiated timeout is larger
+    auto timeout_millis = timeout_millis_ << retries_;
+
+    if (timeout_millis > max::kTimeoutMillis)
+    {
+        timeout_millis = timeout_millis_ > max::kTimeoutMillis ? timeout_millis_ : max::kTimeoutMillis;
+    }
+
+    const auto kMillis = hal::Millis();
+
+    if ((kMillis - activity_millis_) < timeout_millis)
+    {
+        return;
+    }
+
+    if (++retries_ > kRetries)
+    {
+#if defined(CONFIG_TFTP_MULTICAST)
+        if (state_ == State::kMrqDone)
+        {
+            // The server did not ask for the ACK of the last block
+            End();
+            return;
+        }
+#endif
+        DEBUG_PUTS("Timeout");
+        SendError(kErrorCodeOther, "Timeout");
+        Abort();
+        return;
+    }
+
+    activity_millis_ = kMillis;
+    daemon_->statistics_.retransmits++;
+
+    DEBUG_PRINTF("id_=%u, retries_=%u, timeout_millis=%u", id_, retries_, timeout_millis);
+
+    Retransmit();
+}
+
+void Session::Progress()
+{
+    retries_ = 0;
+    activity_millis_ = hal::Millis();
+}
+
+void Session::Retransmit()
+{
+#if defined(CONFIG_TFTP_MULTICAST)
+    if ((state_ == State::kMrqRecvOack) || (state_ == State::kMrqRecvData) || (state_ == State::kMrqDone))
+    {
+        if (is_master_client_)
+        {
+            SendMulticastAck();
+        }
+        else if (state_ != State::kMrqDone)
+        {
+            // RFC 2090: a client that times out sends the request again
+            SendMulticastRequest();
+        }
+        return;
+    }
+#endif
+
+    if ((block_number_ == 0) && (oack_length_ != 0))
+    {
+        SendOptionAck();
+        return;
+    }
+
+    if (state_ == State::kWrqRecvPacket)
+    {
+        DoWriteAck();
+        return;
+    }
+
+    // Send the window again, starting after the last block acknowledged
+    block_number_ = static_cast<uint16_t>(block_number_ - window_count_);
+    is_last_block_ = false;
+    DoRead();
+}
+
+void Session::Abort()
+{
+    DEBUG_ENTRY();
+
+    daemon_->FileAbort(id_);
+    End();
 
     DEBUG_EXIT();
 }
 
-void TFTPDaemon::Input(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port)
+/*
+ * A RRQ or WRQ from a new peer, received on port 69
+ */
+void Session::Request(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port)
 {
+    assert(state_ == State::kFree);
+
     buffer_ = const_cast<uint8_t*>(buffer);
     length_ = size;
     from_ip_ = from_ip;
     from_port_ = from_port;
 
-    switch (state_)
+    HandleRequest();
+}
+
+void Session::Input(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port)
+{
+    buffer_ = const_cast<uint8_t*>(buffer);
+    length_ = size;
+    from_ip_ = from_ip;
+    from_port_ = from_port;
+
+    if (length_ >= sizeof(struct AckPacket))
     {
-        case State::kWaitingRq:
-            if (length_ > tftp::min::kFilenameModeLen)
+        if (reinterpret_cast<const struct AckPacket*>(buffer_)->op_code == __builtin_bswap16(kOpCodeError))
+        {
+            DEBUG_PUTS("Aborted by peer");
+
+            if (state_ == State::kWrqDally)
             {
-                HandleRequest();
+                // The file is complete and closed already
+                End();
+                return;
             }
-            break;
+
+            Abort();
+            return;
+        }
+    }
+
+    switch (state_)
+    {
         case State::kRrqSendPacket:
             DoRead();
             break;
         case State::kRrqRecvAck:
-            if (length_ == sizeof(struct tftp::AckPacket))
+            if (length_ == sizeof(struct AckPacket))
             {
                 HandleRecvAck();
             }
             break;
         case State::kWrqRecvPacket:
-            if (length_ <= sizeof(struct tftp::DataPacket))
+            if (length_ <= (4 + block_size_))
             {
                 HandleRecvData();
             }
             break;
+        case State::kWrqDally:
+            if ((length_ >= sizeof(struct AckPacket)) && (length_ <= (4 + block_size_)))
+            {
+                const auto* const kDataPacket = reinterpret_cast<const struct DataPacket*>(buffer_);
+
+                if ((kDataPacket->op_code == __builtin_bswap16(kOpCodeData)) && (__builtin_bswap16(kDataPacket->block_number) == block_number_))
+                {
+                    DoWriteAck();
+                }
+            }
+            break;
+#if defined(CONFIG_TFTP_MULTICAST)
+        case State::kMrqRecvOack:
+        case State::kMrqRecvData:
+        case State::kMrqDone:
+            if (length_ >= sizeof(struct AckPacket))
+            {
+                HandleMulticast();
+            }
+            break;
+#endif
         default:
-            assert(0);
-            __builtin_unreachable();
             break;
     }
 }
 
-void TFTPDaemon::HandleRequest()
+void Session::HandleRequest()
 {
-    auto* const kPacket = reinterpret_cast<struct tftp::ReqPacket*>(buffer_);
+    auto* const kPacket = reinterpret_cast<struct ReqPacket*>(buffer_);
     assert(kPacket != nullptr);
 
     const auto kOpCode = __builtin_bswap16(kPacket->op_code);
 
-    if ((kOpCode != kOpCodeRrq && kOpCode != kOpCodeWrq))
-    {
-        SendError(kErrorCodeIllOper, "Invalid operation");
-        return;
-    }
-
     const char* const kFileName = kPacket->file_name_mode;
     const auto kFileNameLength = strlen(kFileName);
 
-    if (!(1 <= kFileNameLength && kFileNameLength <= tftp::max::kFilenameLen))
+    if (!(1 <= kFileNameLength && kFileNameLength <= max::kFilenameLen))
     {
-        SendError(kErrorCodeOther, "Invalid file name");
+        daemon_->SendError(from_ip_, from_port_, kErrorCodeOther, "Invalid file name");
         return;
     }
 
+    const char* const kEnd = reinterpret_cast<const char*>(buffer_) + length_;
     const char* const kMode = &kPacket->file_name_mode[kFileNameLength + 1];
     tftp::Mode mode;
 
@@ -226,40 +572,95 @@ void TFTPDaemon::HandleRequest()
     }
     else
     {
-        SendError(kErrorCodeIllOper, "Invalid operation");
+        daemon_->SendError(from_ip_, from_port_, kErrorCodeIllOper, "Invalid operation");
+        return;
+    }
+
+    DEBUG_PRINTF("Incoming %s request from " IPSTR ":%u %s %s, id_=%u", kOpCode == kOpCodeRrq ? "read" : "write", IP2STR(from_ip_), from_port_, kFileName, kMode, id_);
+
+    // The request is answered from the transfer ID of this session
+    if (!Begin())
+    {
+        daemon_->SendError(from_ip_, from_port_, kErrorCodeOther, "Busy, try again later");
         return;
     }
 
-    DEBUG_PRINTF("Incoming %s request from " IPSTR " %s %s", kOpCode == kOpCodeRrq ? "read" : "write", IP2STR(from_ip_), kFileName, kMode);
+    auto& oack_packet = s_oack_packet[id_];
+    uint32_t oack_length = 0;
+
+    if (kMode < kEnd)
+    {
+        const auto* const kModeEnd = StringEnd(kMode, kEnd);
+
+        if (kModeEnd != nullptr)
+        {
+            oack_length = HandleOptions(kModeEnd + 1, kEnd, oack_packet.options);
+        }
+    }
 
     switch (kOpCode)
     {
         case kOpCodeRrq:
-            if (!FileOpen(kFileName, mode))
+            if (!daemon_->FileOpen(id_, kFileName, mode))
             {
                 SendError(kErrorCodeNoFile, "File not found");
-                state_ = State::kWaitingRq;
+                End();
             }
             else
             {
-                network::udp::End(network::iana::Ports::kPortTftp);
-                index_ = network::udp::Begin(from_port_, TFTPDaemon::StaticCallbackFunction);
-                state_ = State::kRrqSendPacket;
-                DoRead();
+                if (has_transfer_size_)
+                {
+                    oack_length = AddOption(oack_packet.options, oack_length, "tsize", daemon_->FileSize(id_));
+                }
+
+                oack_length_ = oack_length;
+
+                if (oack_length_ != 0)
+                {
+                    // The client acknowledges the OACK with ACK block 0
+                    SendOptionAck();
+                    state_ = State::kRrqRecvAck;
+                }
+                else
+                {
+                    state_ = State::kRrqSendPacket;
+                    DoRead();
+                }
             }
             break;
         case kOpCodeWrq:
-            if (!FileCreate(kFileName, mode))
+            if (!daemon_->FileCreate(id_, kFileName, mode))
             {
                 SendError(kErrorCodeAccess, "Access violation");
-                state_ = State::kWaitingRq;
+                End();
+            }
+            else if (has_transfer_size_ && !daemon_->FileAllocate(id_, transfer_size_))
+            {
+                // Rejected before any data is sent
+                SendError(kErrorCodeDiskFull, "File too large");
+                daemon_->FileAbort(id_);
+                End();
             }
             else
             {
-                network::udp::End(network::iana::Ports::kPortTftp);
-                index_ = network::udp::Begin(from_port_, TFTPDaemon::StaticCallbackFunction);
-                state_ = State::kWrqSendAck;
-                DoWriteAck();
+                if (has_transfer_size_)
+                {
+                    oack_length = AddOption(oack_packet.options, oack_length, "tsize", transfer_size_);
+                }
+
+                oack_length_ = oack_length;
+
+                if (oack_length_ != 0)
+                {
+                    // The OACK takes the place of ACK block 0
+                    SendOptionAck();
+                    state_ = State::kWrqRecvPacket;
+                }
+                else
+                {
+                    state_ = State::kWrqSendAck;
+                    DoWriteAck();
+                }
             }
             break;
         default:
@@ -269,110 +670,703 @@ void TFTPDaemon::HandleRequest()
     }
 }
 
-void TFTPDaemon::SendError(uint16_t error_code, const char* error_message)
-{
-    tftp::ErrorPacket error_packet;
-
-    error_packet.op_code = __builtin_bswap16(kOpCodeError);
-    error_packet.error_code = __builtin_bswap16(error_code);
-    strncpy(error_packet.err_msg, error_message, sizeof(error_packet.err_msg) - 1);
-
-    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&error_packet), sizeof error_packet, from_ip_, from_port_);
-}
-
-void TFTPDaemon::DoRead()
+/*
+ * Unknown options are ignored, as required by RFC 2347.
+ * Returns the length of the options to be sent with the OACK, 0 when none are accepted.
+ */
+uint32_t Session::HandleOptions(const char* options, const char* end, char* oack)
 {
-    auto* const kDataPacket = reinterpret_cast<struct tftp::DataPacket*>(buffer_);
-    assert(kDataPacket != nullptr);
+    uint32_t length = 0;
 
-    if (state_ == State::kRrqSendPacket)
+    while (options < end)
     {
-        data_length_ = FileRead(kDataPacket->data, tftp::max::kDataLen, ++block_number_);
-
-        kDataPacket->op_code = __builtin_bswap16(kOpCodeData);
-        kDataPacket->block_number = __builtin_bswap16(block_number_);
-
-        packet_length_ = sizeof kDataPacket->op_code + sizeof kDataPacket->block_number + data_length_;
-        is_last_block_ = data_length_ < tftp::max::kDataLen;
+        const auto* const kOptionEnd = StringEnd(options, end);
 
-        if (is_last_block_)
+        if ((kOptionEnd == nullptr) || ((kOptionEnd + 1) >= end))
         {
-            FileClose();
+            break;
         }
 
-        DEBUG_PRINTF("data_length_=%u, packet_length_=%d, is_last_block_=%d", data_length_, packet_length_, is_last_block_);
-    }
-
-    DEBUG_PRINTF("Sending to " IPSTR ":%d", IP2STR(from_ip_), from_port_);
+        const char* const kValue = kOptionEnd + 1;
+        const auto* const kValueEnd = StringEnd(kValue, end);
 
-    network::udp::Send(index_, buffer_, packet_length_, from_ip_, from_port_);
-
-    state_ = State::kRrqRecvAck;
-}
+        if (kValueEnd == nullptr)
+        {
+            break;
+        }
 
-void TFTPDaemon::HandleRecvAck()
-{
-    const auto* const kAckPacket = reinterpret_cast<struct tftp::AckPacket*>(buffer_);
-    assert(kAckPacket != nullptr);
+        DEBUG_PRINTF("%s=%s", options, kValue);
 
-    if (kAckPacket->op_code == __builtin_bswap16(kOpCodeAck))
-    {
-        DEBUG_PRINTF("Incoming from " IPSTR ", block_number=%d, block_number_=%d", IP2STR(from_ip_), __builtin_bswap16(kAckPacket->block_number),
-                     block_number_);
+        uint32_t value;
 
-        if (kAckPacket->block_number == __builtin_bswap16(block_number_))
+        if (strcasecmp(options, "blksize") == 0)
         {
-            state_ = is_last_block_ ? State::kInit : State::kRrqSendPacket;
+            if (GetValue(kValue, value) && (value >= min::kBlockSize))
+            {
+                block_size_ = value > max::kBlockSize ? max::kBlockSize : value;
+                length = AddOption(oack, length, "blksize", block_size_);
+            }
+        }
+        else if (strcasecmp(options, "windowsize") == 0)
+        {
+            if (GetValue(kValue, value) && (value >= min::kWindowSize))
+            {
+                window_size_ = value > max::kWindowSize ? max::kWindowSize : value;
+                length = AddOption(oack, length, "windowsize", window_size_);
+            }
+        }
+        else if (strcasecmp(options, "timeout") == 0)
+        {
+            if (GetValue(kValue, value) && (value >= min::kTimeout) && (value <= max::kTimeout))
+            {
+                timeout_millis_ = value * 1000U;
+                length = AddOption(oack, length, "timeout", value);
+            }
+        }
+        else if (strcasecmp(options, "tsize") == 0)
+        {
+            // The OACK is completed when the file is opened or created
+            has_transfer_size_ = GetValue(kValue, transfer_size_);
+        }
+
+        options = kValueEnd + 1;
+    }
+
+    return length;
+}
+
+void Session::SendOptionAck()
+{
+    auto& oack_packet = s_oack_packet[id_];
+
+    oack_packet.op_code = __builtin_bswap16(kOpCodeOack);
+    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&oack_packet), sizeof oack_packet.op_code + oack_length_, from_ip_, from_port_);
+}
+
+void Session::SendError(uint16_t error_code, const char* error_message)
+{
+    ErrorPacket error_packet;
+
+    error_packet.op_code = __builtin_bswap16(kOpCodeError);
+    error_packet.error_code = __builtin_bswap16(error_code);
+    strncpy(error_packet.err_msg, error_message, sizeof(error_packet.err_msg) - 1);
+    error_packet.err_msg[sizeof(error_packet.err_msg) - 1] = '\0';
+
+    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&error_packet), sizeof error_packet, from_ip_, from_port_);
+}
+
+/*
+ * Sends the next window of DATA packets, following block_number_.
+ * With RFC 7440 a window holds window_size_ blocks, without the option it is a single block.
+ */
+/*
+ * The block is read straight into the transmit DMA buffer, a retransmission reads it again.
+ */
+void Session::DoRead()
+{
+    window_count_ = 0;
+
+    if (connection_ < 0)
+    {
+        connection_ = network::udp::Connect(index_, from_ip_, from_port_);
+    }
+
+    while ((window_count_ < window_size_) && !is_last_block_)
+    {
+        window_count_++;
+
+        auto* data_packet = reinterpret_cast<struct DataPacket*>(network::udp::AcquireTx(index_, sizeof(struct DataPacket)));
+
+        data_length_ = daemon_->FileRead(id_, data_packet->data, block_size_, ++block_number_, block_size_);
+
+        data_packet->op_code = __builtin_bswap16(kOpCodeData);
+        data_packet->block_number = __builtin_bswap16(block_number_);
+
+        packet_length_ = sizeof data_packet->op_code + sizeof data_packet->block_number + data_length_;
+        is_last_block_ = data_length_ < block_size_;
+
+        DEBUG_PRINTF("data_length_=%u, packet_length_=%d, is_last_block_=%d", data_length_, packet_length_, is_last_block_);
+        DEBUG_PRINTF("Sending to " IPSTR ":%d", IP2STR(from_ip_), from_port_);
+
+        if (connection_ >= 0)
+        {
+            network::udp::CommitTxConnected(connection_, packet_length_);
+        }
+        else
+        {
+            network::udp::CommitTx(packet_length_, from_ip_, from_port_);
         }
     }
+
+    state_ = State::kRrqRecvAck;
 }
 
-void TFTPDaemon::DoWriteAck()
+void Session::HandleRecvAck()
 {
-    auto* const kAckPacket = reinterpret_cast<struct tftp::AckPacket*>(buffer_);
+    const auto* const kAckPacket = reinterpret_cast<struct AckPacket*>(buffer_);
     assert(kAckPacket != nullptr);
 
-    kAckPacket->op_code = __builtin_bswap16(kOpCodeAck);
-    kAckPacket->block_number = __builtin_bswap16(block_number_);
-    state_ = is_last_block_ ? State::kInit : State::kWrqRecvPacket;
+    if (kAckPacket->op_code == __builtin_bswap16(kOpCodeAck))
+    {
+        const auto kBlockNumber = __builtin_bswap16(kAckPacket->block_number);
+
+        DEBUG_PRINTF("Incoming from " IPSTR ", block_number=%d, block_number_=%d", IP2STR(from_ip_), kBlockNumber, block_number_);
 
-    DEBUG_PRINTF("Sending to " IPSTR ":%d, state_=%d", IP2STR(from_ip_), from_port_, static_cast<int>(state_));
+        if (kBlockNumber == block_number_)
+        {
+            Progress();
 
-    network::udp::Send(index_, buffer_, sizeof(struct tftp::AckPacket), from_ip_, from_port_);
+            if (is_last_block_)
+            {
+                daemon_->FileClose(id_);
+                End();
+            }
+            else
+            {
+                state_ = State::kRrqSendPacket;
+                DoRead();
+            }
+
+            return;
+        }
 
-    if (state_ == State::kInit)
+        // RFC 7440: an ACK within the window that was sent; continue right after the block acknowledged.
+        // Older ACKs are ignored, so a duplicate ACK does not cause the window to be sent twice.
+        const auto kOutstanding = static_cast<uint16_t>(block_number_ - kBlockNumber);
+
+        if (kOutstanding < window_count_)
+        {
+            Progress();
+            block_number_ = kBlockNumber;
+            is_last_block_ = false;
+            state_ = State::kRrqSendPacket;
+            DoRead();
+        }
+    }
+}
+
+void Session::DoWriteAck()
+{
+    AckPacket ack_packet;
+
+    ack_packet.op_code = __builtin_bswap16(kOpCodeAck);
+    ack_packet.block_number = __builtin_bswap16(block_number_);
+    window_count_ = 0;
+
+    DEBUG_PRINTF("Sending to " IPSTR ":%d, is_last_block_=%d", IP2STR(from_ip_), from_port_, is_last_block_);
+
+    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&ack_packet), sizeof(struct AckPacket), from_ip_, from_port_);
+
+    if (is_last_block_)
     {
-        Init();
+        // RFC 1350, 6: the final ACK can be lost, the last block is acknowledged again when it is received again
+        Progress();
+        state_ = State::kWrqDally;
+    }
+    else
+    {
+        state_ = State::kWrqRecvPacket;
     }
 }
 
-void TFTPDaemon::HandleRecvData()
+void Session::HandleRecvData()
 {
-    const auto* const kDataPacket = reinterpret_cast<struct tftp::DataPacket*>(buffer_);
+    const auto* const kDataPacket = reinterpret_cast<struct DataPacket*>(buffer_);
     assert(kDataPacket != nullptr);
 
     if (kDataPacket->op_code == __builtin_bswap16(kOpCodeData))
     {
+        const auto kBlockNumber = __builtin_bswap16(kDataPacket->block_number);
+
         data_length_ = length_ - 4;
-        block_number_ = __builtin_bswap16(kDataPacket->block_number);
 
-        DEBUG_PRINTF("Incoming from " IPSTR ", length_=%u, block_number_=%d, data_length_=%u", IP2STR(from_ip_), length_, block_number_, data_length_);
+        DEBUG_PRINTF("Incoming from " IPSTR ", length_=%u, block_number=%d, data_length_=%u", IP2STR(from_ip_), length_, kBlockNumber, data_length_);
 
-        if (data_length_ == FileWrite(kDataPacket->data, data_length_, block_number_))
+        if (kBlockNumber != static_cast<uint16_t>(block_number_ + 1))
         {
-            if (data_length_ < tftp::max::kDataLen)
+            // RFC 7440 window rollback: a block is missing, or this block was already received.
+            // Acknowledge the last block received in sequence, the client continues from there.
+            // The remainder of the window that is still in flight is not acknowledged again.
+            daemon_->statistics_.out_of_order++;
+
+            if ((out_of_order_count_++ % window_size_) == 0)
+            {
+                DoWriteAck();
+            }
+
+            return;
+        }
+
+        out_of_order_count_ = 0;
+        Progress();
+
+        if (data_length_ == daemon_->FileWrite(id_, kDataPacket->data, data_length_, kBlockNumber, block_size_))
+        {
+            block_number_ = kBlockNumber;
+
+            if (data_length_ < block_size_)
             {
                 is_last_block_ = true;
-                FileClose();
+
+                if (!daemon_->FileClose(id_))
+                {
+                    // The last block is not acknowledged, the client reports the failure
+                    SendError(kErrorCodeDiskFull, "Write failed");
+                    Abort();
+                    return;
+                }
+            }
+
+            if (is_last_block_ || (++window_count_ == window_size_))
+            {
+                DoWriteAck();
+            }
+        }
+        else
+        {
+            SendError(kErrorCodeDiskFull, "Write failed");
+            Abort();
+        }
+    }
+}
+
+#if defined(CONFIG_TFTP_MULTICAST)
+/*
+ * RFC 2090: the RRQ carries the multicast option. The server answers with an OACK holding the group address and port,
+ * and whether this node is the master client. Only the master client acknowledges the blocks, the other nodes listen.
+ * When the master client is done, the server appoints the next one, which acknowledges the blocks it still misses.
+ *
+ * The blocks are written in sequence, so a node that misses a block waits until it becomes the master client.
+ */
+bool Session::MulticastRequest(uint32_t server_ip, const char* file_name)
+{
+    DEBUG_ENTRY();
+    assert(state_ == State::kFree);
+
+    const auto kFileNameLength = static_cast<uint32_t>(strlen(file_name));
+
+    if (!(1 <= kFileNameLength && kFileNameLength <= max::kFilenameLen))
+    {
+        DEBUG_EXIT();
+        return false;
+    }
+
+    if (!daemon_->FileCreate(id_, file_name, tftp::Mode::kBinary))
+    {
+        DEBUG_EXIT();
+        return false;
+    }
+
+    auto& request = s_multicast_request;
+    auto* request_data = request.file_name_mode;
+
+    request.op_code = __builtin_bswap16(kOpCodeRrq);
+
+    uint32_t length = kFileNameLength + 1;
+    memcpy(request_data, file_name, length);
+    memcpy(&request_data[length], "octet", sizeof("octet"));
+    length += sizeof("octet");
+    memcpy(&request_data[length], "multicast", sizeof("multicast"));
+    length += sizeof("multicast");
+    request_data[length++] = '\0';
+
+    auto options_length = AddOption(&request_data[length], 0, "blksize", max::kBlockSize);
+    options_length = AddOption(&request_data[length], options_length, "tsize", 0);
+
+    request_length_ = static_cast<uint32_t>(sizeof request.op_code) + length + options_length;
+
+    if (!Begin())
+    {
+        daemon_->FileAbort(id_);
+        DEBUG_EXIT();
+        return false;
+    }
+
+    server_ip_ = server_ip;
+    from_ip_ = server_ip;
+    from_port_ = network::iana::Ports::kPortTftp;
+    multicast_ip_ = 0;
+    multicast_port_ = 0;
+    is_master_client_ = false;
+
+    DEBUG_PRINTF("Request %s from " IPSTR, file_name, IP2STR(server_ip_));
+
+    SendMulticastRequest();
+
+    state_ = State::kMrqRecvOack;
+
+    DEBUG_EXIT();
+    return true;
+}
+
+void Session::SendMulticastRequest()
+{
+    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&s_multicast_request), request_length_, server_ip_, network::iana::Ports::kPortTftp);
+}
+
+void Session::SendMulticastAck()
+{
+    AckPacket ack_packet;
+
+    ack_packet.op_code = __builtin_bswap16(kOpCodeAck);
+    ack_packet.block_number = __builtin_bswap16(block_number_);
+
+    DEBUG_PRINTF("Sending to " IPSTR ":%d, block_number_=%u", IP2STR(server_ip_), from_port_, block_number_);
+
+    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&ack_packet), sizeof(struct AckPacket), server_ip_, from_port_);
+}
+
+void Session::HandleMulticast()
+{
+    const auto kOpCode = __builtin_bswap16(reinterpret_cast<const struct AckPacket*>(buffer_)->op_code);
+
+    if (kOpCode == kOpCodeOack)
+    {
+        HandleMulticastOack();
+        return;
+    }
+
+    if ((kOpCode == kOpCodeData) && (length_ <= (4 + block_size_)))
+    {
+        if (state_ == State::kMrqRecvOack)
+        {
+            // The server ignored the multicast option, this is a unicast transfer
+            is_master_client_ = true;
+            state_ = State::kMrqRecvData;
+        }
+
+        HandleMulticastData();
+    }
+}
+
+void Session::HandleMulticastOack()
+{
+    const char* options = reinterpret_cast<const char*>(buffer_) + sizeof(uint16_t);
+    const char* const kEnd = reinterpret_cast<const char*>(buffer_) + length_;
+    auto is_master_client = is_master_client_;
+    auto has_multicast = false;
+
+    while (options < kEnd)
+    {
+        const auto* const kOptionEnd = StringEnd(options, kEnd);
+
+        if ((kOptionEnd == nullptr) || ((kOptionEnd + 1) >= kEnd))
+        {
+            break;
+        }
+
+        const char* const kValue = kOptionEnd + 1;
+        const auto* const kValueEnd = StringEnd(kValue, kEnd);
+
+        if (kValueEnd == nullptr)
+        {
+            break;
+        }
+
+        DEBUG_PRINTF("%s=%s", options, kValue);
+
+        uint32_t value;
+
+        if (strcasecmp(options, "multicast") == 0)
+        {
+            has_multicast = GetMulticast(kValue, multicast_ip_, multicast_port_, is_master_client);
+        }
+        else if (state_ == State::kMrqRecvOack)
+        {
+            // The transfer options are only taken from the first OACK
+            if (strcasecmp(options, "blksize") == 0)
+            {
+                if (GetValue(kValue, value) && (value >= min::kBlockSize) && (value <= max::kBlockSize))
+                {
+                    block_size_ = value;
+                }
+            }
+            else if (strcasecmp(options, "tsize") == 0)
+            {
+                if (GetValue(kValue, value) && !daemon_->FileAllocate(id_, value))
+                {
+                    SendError(kErrorCodeDiskFull, "File too large");
+                    Abort();
+                    return;
+                }
+            }
+        }
+
+        options = kValueEnd + 1;
+    }
+
+    Progress();
+
+    if (state_ == State::kMrqRecvOack)
+    {
+        if (has_multicast && (multicast_ip_ != 0) && (multicast_port_ != 0))
+        {
+            multicast_index_ = (multicast_port_ != port_) ? network::udp::Begin(multicast_port_, TFTPDaemon::StaticCallbackFunction, network::udp::Delivery::kCopy) : index_;
+
+            if (multicast_index_ < 0)
+            {
+                multicast_ip_ = 0;
+                SendError(kErrorCodeOther, "Busy, try again later");
+                Abort();
+                return;
             }
 
-            DoWriteAck();
+            network::igmp::JoinGroup(multicast_index_, multicast_ip_);
         }
         else
         {
+            // The server does not support multicast, this is a unicast transfer
+            multicast_ip_ = 0;
+            is_master_client = true;
+        }
+
+        DEBUG_PRINTF(IPSTR ":%u, is_master_client=%d", IP2STR(multicast_ip_), multicast_port_, is_master_client);
+
+        state_ = State::kMrqRecvData;
+    }
+
+    is_master_client_ = is_master_client;
+
+    if (is_master_client_)
+    {
+        // Acknowledges the OACK, or the last block received in sequence
+        SendMulticastAck();
+
+        if (state_ == State::kMrqDone)
+        {
+            End();
+        }
+    }
+}
+
+void Session::HandleMulticastData()
+{
+    const auto* const kDataPacket = reinterpret_cast<struct DataPacket*>(buffer_);
+    const auto kBlockNumber = __builtin_bswap16(kDataPacket->block_number);
+
+    data_length_ = length_ - 4;
+
+    DEBUG_PRINTF("length_=%u, block_number=%d, data_length_=%u", length_, kBlockNumber, data_length_);
+
+    if (!is_master_client_)
+    {
+        // The server is serving other nodes
+        Progress();
+    }
+
+    if ((state_ == State::kMrqDone) || (kBlockNumber != static_cast<uint16_t>(block_number_ + 1)))
+    {
+        if (is_master_client_ && (state_ != State::kMrqDone))
+        {
+            // A block is missing, the server continues after the last block received in sequence
+            SendMulticastAck();
+        }
+
+        return;
+    }
+
+    Progress();
+
+    if (data_length_ != daemon_->FileWrite(id_, kDataPacket->data, data_length_, kBlockNumber, block_size_))
+    {
+        SendError(kErrorCodeDiskFull, "Write failed");
+        Abort();
+        return;
+    }
+
+    block_number_ = kBlockNumber;
+
+    if (data_length_ < block_size_)
+    {
+        if (!daemon_->FileClose(id_))
+        {
+            // The last block is not acknowledged, the server reports the failure
             SendError(kErrorCodeDiskFull, "Write failed");
-            state_ = State::kInit;
-            Init();
+            Abort();
+            return;
+        }
+
+        state_ = State::kMrqDone;
+    }
+
+    if (is_master_client_)
+    {
+        SendMulticastAck();
+
+        if (state_ == State::kMrqDone)
+        {
+            End();
         }
     }
 }
+
+void Session::MulticastEnd()
+{
+    if (multicast_ip_ != 0)
+    {
+        network::igmp::LeaveGroup(multicast_index_, multicast_ip_);
+
+        if (multicast_port_ != port_)
+        {
+            network::udp::End(multicast_port_);
+        }
+
+        multicast_index_ = -1;
+        multicast_ip_ = 0;
+    }
+
+    server_ip_ = 0;
+}
+#endif
+} // namespace tftp
+
+TFTPDaemon::TFTPDaemon()
+{
+    DEBUG_ENTRY();
+    DEBUG_PRINTF("s_this=%p", reinterpret_cast<void*>(s_this));
+
+    if (s_this != nullptr)
+    {
+        s_this->Exit();
+    }
+
+    s_this = this;
+
+    for (uint32_t i = 0; i < TFTP_MAX_SESSIONS; i++)
+    {
+        sessions_[i].Init(this, i);
+    }
+
+    index_ = network::udp::Begin(network::iana::Ports::kPortTftp, TFTPDaemon::StaticCallbackFunction, network::udp::Delivery::kCopy);
+    DEBUG_PRINTF("index_=%d", index_);
+
+    DEBUG_PRINTF("s_this=%p", reinterpret_cast<void*>(s_this));
+    DEBUG_EXIT();
+}
+
+TFTPDaemon::~TFTPDaemon()
+{
+    DEBUG_ENTRY();
+    DEBUG_PRINTF("s_this=%p", reinterpret_cast<void*>(s_this));
+
+    if (timer_id_ != kTimerIdNone)
+    {
+        SoftwareTimerDelete(timer_id_);
+    }
+
+    for (auto& session : sessions_)
+    {
+        session.Close();
+    }
+
+    network::udp::End(network::iana::Ports::kPortTftp);
+    index_ = -1;
+
+    s_this = nullptr;
+
+    DEBUG_EXIT();
+}
+
+/*
+ * A single timer services the retransmissions of all sessions.
+ * It is added with the first session and deleted by the destructor, never from within its own callback.
+ */
+void TFTPDaemon::TimerStart()
+{
+    if (timer_id_ == kTimerIdNone)
+    {
+        timer_id_ = SoftwareTimerAdd(tftp::kTimerIntervalMillis, TFTPDaemon::StaticTimerFunction);
+        DEBUG_PRINTF("timer_id_=%d", timer_id_);
+    }
+}
+
+void TFTPDaemon::Timer()
+{
+    for (auto& session : sessions_)
+    {
+        if (!session.IsFree())
+        {
+            session.Timer();
+        }
+    }
+}
+
+void TFTPDaemon::SendError(uint32_t to_ip, uint16_t to_port, uint16_t error_code, const char* error_message)
+{
+    tftp::ErrorPacket error_packet;
+
+    error_packet.op_code = __builtin_bswap16(kOpCodeError);
+    error_packet.error_code = __builtin_bswap16(error_code);
+    strncpy(error_packet.err_msg, error_message, sizeof(error_packet.err_msg) - 1);
+    error_packet.err_msg[sizeof(error_packet.err_msg) - 1] = '\0';
+
+    network::udp::Send(index_, reinterpret_cast<const uint8_t*>(&error_packet), sizeof error_packet, to_ip, to_port);
+}
+
+/*
+ * All ports, 69 and the transfer IDs of the sessions, share this callback.
+ * A datagram is passed to the session of the peer, a request from a new peer gets a free session.
+ */
+void TFTPDaemon::Input(const uint8_t* buffer, uint32_t size, uint32_t from_ip, uint16_t from_port)
+{
+    for (auto& session : sessions_)
+    {
+        if (session.IsPeer(from_ip, from_port))
+        {
+            session.Input(buffer, size, from_ip, from_port);
+            return;
+        }
+    }
+
+    if (size <= tftp::min::kFilenameModeLen)
+    {
+        // Not a request, possibly a retransmission for a session that has ended
+        return;
+    }
+
+    const auto kOpCode = __builtin_bswap16(reinterpret_cast<const struct tftp::ReqPacket*>(buffer)->op_code);
+
+    if ((kOpCode != kOpCodeRrq) && (kOpCode != kOpCodeWrq))
+    {
+        SendError(from_ip, from_port, kErrorCodeIllOper, "Invalid operation");
+        return;
+    }
+
+    for (auto& session : sessions_)
+    {
+        if (session.IsFree())
+        {
+            session.Request(buffer, size, from_ip, from_port);
+            return;
+        }
+    }
+
+    DEBUG_PRINTF("Busy " IPSTR ":%u", IP2STR(from_ip), from_port);
+    SendError(from_ip, from_port, kErrorCodeOther, "Busy, try again later");
+}
+
+#if defined(CONFIG_TFTP_MULTICAST)
+bool TFTPDaemon::MulticastRequest(uint32_t server_ip, const char* file_name)
+{
+    assert(file_name != nullptr);
+
+    for (auto& session : sessions_)
+    {
+        if (session.IsMulticast())
+        {
+            // A single multicast group is received
+            return false;
+        }
+    }
+
+    for (auto& session : sessions_)
+    {
+        if (session.IsFree())
+        {
+            return session.MulticastRequest(server_ip, file_name);
+        }
+    }
+
+    return false;
+}
+#endif
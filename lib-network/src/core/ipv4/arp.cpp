@@ -103,6 +103,7 @@ struct Record
 static network::arp::Record s_arp_records[kMaxRecords] SECTION_NETWORK ALIGNED;
 static struct network::arp::Header s_arp_request SECTION_NETWORK ALIGNED;
 static struct network::arp::Header s_arp_reply SECTION_NETWORK ALIGNED;
+static uint32_t s_generation; ///< Changes when a MAC address is learned, changed or dropped
 
 #ifndef NDEBUG
 static constexpr char kStates[4][12] = {
@@ -214,6 +215,11 @@ static void CacheUpdate(const uint8_t* mac_address, uint32_t ip, arp::Flags flag
         return;
     }
 
+    if ((record->state < network::arp::State::kStateReachable) || (std::memcmp(record->mac_address, mac_address, network::ethernet::kAddressLength) != 0))
+    {
+        s_generation++;
+    }
+
     record->state = network::arp::State::kStateReachable;
     record->age = 0;
     std::memcpy(record->mac_address, mac_address, network::ethernet::kAddressLength);
@@ -343,6 +349,7 @@ static void Timer([[maybe_unused]] TimerHandle_t handle)
                     if (record.age > network::arp::kMaxStale)
                     {
                         record.state = network::arp::State::kStateProbe;
+                        s_generation++;
                         SendRequestUnicast(record.ip, record.mac_address);
                     }
                     break;
@@ -472,6 +479,27 @@ __attribute__((hot)) void Input(const struct network::arp::Header* arp)
     }
 }
 
+/*
+ * The gateway, for a remote address that is not on the local network.
+ */
+static uint32_t NextHop(uint32_t remote_ip)
+{
+    if (__builtin_expect((network::global::on_network_mask != (remote_ip & network::global::on_network_mask)), 0))
+    {
+        /* According to RFC 3297, chapter 2.6.2 (Forwarding Rules), a packet with
+           a link-local source address must always be "directly to its destination
+           on the same physical link. The host MUST NOT send the packet to any
+           router for forwarding". */
+        if (!network::IsLinklocalIp(remote_ip))
+        {
+            DEBUG_PUTS("");
+            return netif::global::netif_default.gw.addr;
+        }
+    }
+
+    return remote_ip;
+}
+
 template <network::arp::EthSend S> static void SendImplementation(void* packet, uint32_t size, uint32_t remote_ip)
 {
     DEBUG_ENTRY();
@@ -494,37 +522,41 @@ template <network::arp::EthSend S> static void SendImplementation(void* packet,
     p->ip4.chksum = Chksum(reinterpret_cast<void*>(&p->ip4), sizeof(p->ip4));
 #endif
 
-    auto destination_ip = remote_ip;
-
-    if (__builtin_expect((network::global::on_network_mask != (remote_ip & network::global::on_network_mask)), 0))
-    {
-        /* According to RFC 3297, chapter 2.6.2 (Forwarding Rules), a packet with
-           a link-local source address must always be "directly to its destination
-           on the same physical link. The host MUST NOT send the packet to any
-           router for forwarding". */
-        if (!network::IsLinklocalIp(remote_ip))
-        {
-            destination_ip = netif.gw.addr;
-            DEBUG_PUTS("");
-        }
-    }
+    const auto kDestinationIp = NextHop(remote_ip);
 
     for (auto& record : s_arp_records)
     {
         if (record.state >= network::arp::State::kStateReachable)
         {
-            if (record.ip == destination_ip)
+            if (record.ip == kDestinationIp)
             {
                 std::memcpy(p->ether.dst, record.mac_address, network::ethernet::kAddressLength);
 
+                // A packet that is built in the transmit DMA buffer is not copied again
+                const auto kIsDmaBuffer = (packet == emac_eth_send_get_dma_buffer());
+
                 if constexpr (S == network::arp::EthSend::kIsNormal)
                 {
-                    emac_eth_send(packet, size);
+                    if (kIsDmaBuffer)
+                    {
+                        emac_eth_send(size);
+                    }
+                    else
+                    {
+                        emac_eth_send(packet, size);
+                    }
                 }
 #if defined CONFIG_NET_ENABLE_PTP
                 else if constexpr (S == network::arp::EthSend::kIsTimestamp)
                 {
-                    emac_eth_send_timestamp(packet, size);
+                    if (kIsDmaBuffer)
+                    {
+                        emac_eth_send_timestamp(size);
+                    }
+                    else
+                    {
+                        emac_eth_send_timestamp(packet, size);
+                    }
                 }
 #endif
                 DEBUG_EXIT();
@@ -533,12 +565,38 @@ template <network::arp::EthSend S> static void SendImplementation(void* packet,
         }
     }
 
-    Query<S>(destination_ip, packet, size, arp::Flags::kFlagInsert);
+    Query<S>(kDestinationIp, packet, size, arp::Flags::kFlagInsert);
 
     DEBUG_EXIT();
     return;
 }
 
+bool Lookup(uint32_t remote_ip, uint8_t* mac_address)
+{
+    if (__builtin_expect((netif::global::netif_default.ip.addr == 0), 0))
+    {
+        return false;
+    }
+
+    const auto kDestinationIp = NextHop(remote_ip);
+
+    for (const auto& record : s_arp_records)
+    {
+        if ((record.state >= network::arp::State::kStateReachable) && (record.ip == kDestinationIp))
+        {
+            std::memcpy(mac_address, record.mac_address, network::ethernet::kAddressLength);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t Generation()
+{
+    return s_generation;
+}
+
 void Send(void* packet, uint32_t size, uint32_t remote_ip)
 {
     SendImplementation<network::arp::EthSend::kIsNormal>(packet, size, remote_ip);
@@ -124,6 +124,7 @@ namespace udp
 {
 void Init();
 void Input(const struct Header*);
+void NetifChanged();
 void Shutdown();
 } // namespace udp
 
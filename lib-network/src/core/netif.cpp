@@ -76,6 +76,8 @@ static void NetifDoUpdateGlobals()
 
     network::global::broadcast_mask = ~(netif.netmask.addr);
     network::global::on_network_mask = netif.ip.addr & netif.netmask.addr;
+
+    network::udp::NetifChanged();
 }
 
 static void NetifDoIpAddrChanged([[maybe_unused]] network::ip4_addr_t old_addr, [[maybe_unused]] network::ip4_addr_t new_addr)
@@ -159,6 +161,8 @@ static bool NetifDoSetGw(network::ip4_addr_t gw, network::ip4_addr_t& old_gw)
         old_gw.addr = netif.gw.addr;
         netif.gw.addr = gw.addr;
 
+        network::udp::NetifChanged();
+
         DEBUG_EXIT();
         return true; // gateway changed
     }
@@ -88,6 +88,7 @@ class Allocator
 
     bool IsEmpty() const { return free_mask_ == kAllMask; }
     bool IsFull() const { return free_mask_ == 0; }
+    uint32_t Available() const { return static_cast<uint32_t>(__builtin_popcount(free_mask_)); }
 
     uint8_t* Allocate()
     {
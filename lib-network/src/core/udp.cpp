@@ -46,6 +46,8 @@
 #include "network_udp.h"
 #include "net_private.h"
 #include "net_memcpy.h"
+#include "udp_porthash.h"
+#include "network_memory.h"
 #include "firmware/debug/debug_debug.h"
 
 namespace network::udp
@@ -54,6 +56,26 @@ struct PortInfo
 {
     UdpCallbackFunctionPtr callback;
     uint16_t port;
+    Delivery delivery;
+};
+
+/*
+ * A polled port with a queue depth, the datagrams are kept in pool blocks.
+ */
+struct Queue
+{
+    struct Entry
+    {
+        uint32_t from_ip;
+        uint16_t from_port;
+        uint16_t block;
+    };
+    Entry entries[UDP_MAX_QUEUE_DEPTH];
+    uint32_t overflows;
+    uint16_t current; ///< The block returned by Recv, freed by the next Recv
+    uint8_t depth;
+    uint8_t head;
+    uint8_t count;
 };
 
 struct Data
@@ -62,15 +84,52 @@ struct Data
     uint32_t size;
     uint8_t data[kDataSize];
     uint16_t from_port;
+    int32_t index;
 };
 
-struct Port
+/*
+ * The Ethernet, IPv4 and UDP headers up to the UDP length.
+ */
+struct Headers
+{
+    struct network::ethernet::Header ether;
+    struct network::ip4::Ip4Header ip4;
+    uint16_t source_port;
+    uint16_t destination_port;
+} PACKED;
+
+struct Connection
 {
-    PortInfo info;
-    Data data ALIGNED;
-} ALIGNED;
+    Headers headers;
+    uint32_t sum; ///< Ones' complement sum of the IPv4 header, with the length, id and checksum zero
+    uint32_t remote_ip;
+    uint32_t arp_generation;
+    int32_t index; ///< Port index, -1 is free
+    uint16_t remote_port;
+    bool is_valid;
+};
 
-static Port s_ports[UDP_MAX_PORTS_ALLOWED] SECTION_NETWORK ALIGNED;
+static PortInfo s_ports[UDP_MAX_PORTS_ALLOWED] SECTION_NETWORK ALIGNED;
+static Connection s_connections[UDP_MAX_CONNECTIONS] SECTION_NETWORK ALIGNED;
+/*
+ * A callback gets the payload in the receive DMA buffer. Only the ports that are polled,
+ * and the callbacks that asked for it, get a copy.
+ * A polled port without a queue has a slot of its own, the index of a free slot is -1.
+ */
+static Data s_recv_data[UDP_MAX_POLLED_PORTS] SECTION_NETWORK ALIGNED;
+static Data s_copy_data SECTION_NETWORK ALIGNED;
+static Queue s_queues[UDP_MAX_PORTS_ALLOWED] SECTION_NETWORK ALIGNED;
+/*
+ * The queues leave a block in the pool, for the packet that ARP holds while resolving.
+ */
+static constexpr uint32_t kReservedBlocks = 1;
+
+static_assert(UDP_MAX_QUEUE_DEPTH < 256);
+static bool s_is_held;
+static int32_t s_tx_index = -1;
+static uint32_t s_tx_max_length;
+
+static PortHash<UDP_MAX_PORTS_ALLOWED> s_hash SECTION_NETWORK ALIGNED;
 static uint16_t s_id SECTION_NETWORK ALIGNED;
 static uint8_t s_multicast_mac[network::ethernet::kAddressLength] SECTION_NETWORK ALIGNED;
 
@@ -80,6 +139,17 @@ void __attribute__((cold)) Init()
     s_multicast_mac[0] = network::ethernet::kIP4MulticastAddr0;
     s_multicast_mac[1] = network::ethernet::kIP4MulticastAddr1;
     s_multicast_mac[2] = network::ethernet::kIP4MulticastAddr2;
+
+    for (auto& connection : s_connections)
+    {
+        connection.index = -1;
+    }
+
+    for (auto& data : s_recv_data)
+    {
+        data.index = -1;
+        data.size = 0;
+    }
 }
 
 void __attribute__((cold)) Shutdown()
@@ -89,54 +159,182 @@ void __attribute__((cold)) Shutdown()
     DEBUG_EXIT();
 }
 
+static Data* GetRecvData(int32_t index)
+{
+    for (auto& data : s_recv_data)
+    {
+        if (data.index == index)
+        {
+            return &data;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Stores the datagram, as the receive buffer is released before it is handled.
+ */
+static void Copy(Data& data, int32_t index, const struct Header* udp, uint32_t size)
+{
+    network::memcpy(data.data, udp->udp.data, size);
+    data.from_ip = network::memcpy_ip(udp->ip4.src);
+    data.from_port = __builtin_bswap16(udp->udp.source_port);
+    data.size = size;
+    data.index = index;
+}
+
+static void Enqueue(Queue& queue, const struct Header* udp, uint32_t size)
+{
+    auto& allocator = network::memory::Allocator::Instance();
+
+    if ((queue.count == queue.depth) || (allocator.Available() <= kReservedBlocks))
+    {
+        queue.overflows++;
+        return;
+    }
+
+    // A block is a little smaller than the largest datagram
+    const auto kBlock = allocator.Allocate(udp->udp.data, static_cast<uint16_t>(std::min(size, network::memory::kBlockSize)));
+    auto& entry = queue.entries[(queue.head + queue.count) % queue.depth];
+
+    entry.from_ip = network::memcpy_ip(udp->ip4.src);
+    entry.from_port = __builtin_bswap16(udp->udp.source_port);
+    entry.block = kBlock;
+
+    queue.count++;
+}
+
+static void QueueClear(Queue& queue)
+{
+    auto& allocator = network::memory::Allocator::Instance();
+
+    allocator.Free(queue.current);
+    queue.current = UINT16_MAX;
+
+    while (queue.count != 0)
+    {
+        allocator.Free(queue.entries[queue.head].block);
+        queue.head = static_cast<uint8_t>((queue.head + 1) % queue.depth);
+        queue.count--;
+    }
+}
+
 __attribute__((hot)) void Input(const struct Header* udp)
 {
     const auto kDestinationPort = __builtin_bswap16(udp->udp.destination_port);
+    const auto kPortIndex = s_hash.Get(s_hash.Slot(kDestinationPort, s_ports));
+
+    if (__builtin_expect((kPortIndex < 0), 0))
+    {
+        emac_free_pkt();
 
-    for (uint32_t port_index = 0; port_index < UDP_MAX_PORTS_ALLOWED; port_index++)
+        DEBUG_PRINTF(IPSTR ":%d[%x] " MACSTR, udp->ip4.src[0], udp->ip4.src[1], udp->ip4.src[2], udp->ip4.src[3], kDestinationPort, kDestinationPort, MAC2STR(udp->ether.dst));
+        return;
+    }
+
+    const auto& info = s_ports[kPortIndex];
+    const auto kDataLength = __builtin_bswap16(udp->udp.len) - kHeaderSize;
+    const auto kSize = std::min(kDataSize, kDataLength);
+
+    if (__builtin_expect((info.callback == nullptr), 0))
     {
-        const auto& info = s_ports[port_index].info;
+        auto& queue = s_queues[kPortIndex];
 
-        if (info.port == kDestinationPort)
+        if (queue.depth != 0)
+        {
+            // An empty datagram cannot be told apart from no datagram by Recv
+            if (kSize != 0)
+            {
+                Enqueue(queue, udp, kSize);
+            }
+        }
+        else
         {
-            auto& data = s_ports[port_index].data;
+            auto* data = GetRecvData(kPortIndex);
+            assert(data != nullptr);
 
-            if (__builtin_expect((data.size != 0), 0))
+            // The unread datagram of this port is replaced
+            if (__builtin_expect((data->size != 0), 0))
             {
+                queue.overflows++;
                 DEBUG_PRINTF("%d[%x]", kDestinationPort, kDestinationPort);
             }
 
-            const auto kDataLength = __builtin_bswap16(udp->udp.len) - kHeaderSize;
-            const auto kSize = std::min(kDataSize, kDataLength);
+            Copy(*data, kPortIndex, udp, kSize);
+        }
 
-            network::memcpy(data.data, udp->udp.data, kSize);
-            data.from_ip = network::memcpy_ip(udp->ip4.src);
-            data.from_port = __builtin_bswap16(udp->udp.source_port);
-            data.size = kSize;
+        emac_free_pkt();
+        return;
+    }
 
-            emac_free_pkt();
+    if (info.delivery == Delivery::kCopy)
+    {
+        Copy(s_copy_data, kPortIndex, udp, kSize);
+        emac_free_pkt();
 
-            if (info.callback != nullptr)
-            {
-                info.callback(data.data, kSize, data.from_ip, data.from_port);
-            }
+        info.callback(s_copy_data.data, kSize, s_copy_data.from_ip, s_copy_data.from_port);
+        return;
+    }
 
-            return;
-        }
+    // The callback reads the payload straight from the receive DMA buffer
+    s_is_held = true;
+
+    info.callback(udp->udp.data, kSize, network::memcpy_ip(udp->ip4.src), __builtin_bswap16(udp->udp.source_port));
+
+    Release();
+}
+
+void Release()
+{
+    if (s_is_held)
+    {
+        s_is_held = false;
+        emac_free_pkt();
     }
+}
 
-    emac_free_pkt();
+/*
+ * Returns false for a unicast address, its MAC address comes from the ARP cache.
+ */
+static bool GetBroadcastMulticastMac(uint32_t remote_ip, uint8_t* mac_address)
+{
+    if ((remote_ip == network::kIpaddrBroadcast) || ((remote_ip & network::global::broadcast_mask) == network::global::broadcast_mask))
+    {
+        network::memset<0xFF, network::ethernet::kAddressLength>(mac_address);
+        return true;
+    }
+
+    if ((remote_ip & 0xF0) == 0xE0)
+    { // Multicast, we know the MAC Address
+        typedef union pcast32
+        {
+            uint32_t u32;
+            uint8_t u8[4];
+        } _pcast32;
+        _pcast32 multicast_ip;
+
+        multicast_ip.u32 = remote_ip;
+        s_multicast_mac[3] = multicast_ip.u8[1] & 0x7F;
+        s_multicast_mac[4] = multicast_ip.u8[2];
+        s_multicast_mac[5] = multicast_ip.u8[3];
+
+        std::memcpy(mac_address, s_multicast_mac, network::ethernet::kAddressLength);
+        return true;
+    }
 
-    DEBUG_PRINTF(IPSTR ":%d[%x] " MACSTR, udp->ip4.src[0], udp->ip4.src[1], udp->ip4.src[2], udp->ip4.src[3], kDestinationPort, kDestinationPort, MAC2STR(udp->ether.dst));
+    return false;
 }
 
-template <network::arp::EthSend S> static void SendImplementation(int index, const uint8_t* data, uint32_t size, uint32_t remote_ip, uint16_t remote_port)
+/*
+ * The payload is in the transmit DMA buffer already, the headers are filled in.
+ */
+template <network::arp::EthSend S> static void Transmit(int index, Header* out_buffer, uint32_t size, uint32_t remote_ip, uint16_t remote_port)
 {
     assert(index >= 0);
     assert(index < UDP_MAX_PORTS_ALLOWED);
-    assert(s_ports[index].info.port != 0);
-
-    auto* out_buffer = reinterpret_cast<Header*>(emac_eth_send_get_dma_buffer());
+    assert(s_ports[index].port != 0);
+    assert(size <= kDataSize);
 
     // Ethernet
     std::memcpy(out_buffer->ether.src, netif::global::netif_default.hwaddr, network::ethernet::kAddressLength);
@@ -154,60 +352,28 @@ template <network::arp::EthSend S> static void SendImplementation(int index, con
     network::memcpy_ip(out_buffer->ip4.src, netif::global::netif_default.ip.addr);
 
     // UDP
-    out_buffer->udp.source_port = __builtin_bswap16(s_ports[index].info.port);
+    out_buffer->udp.source_port = __builtin_bswap16(s_ports[index].port);
     out_buffer->udp.destination_port = __builtin_bswap16(remote_port);
     out_buffer->udp.len = __builtin_bswap16(static_cast<uint16_t>(size + kHeaderSize));
     out_buffer->udp.checksum = 0;
 
-    size = std::min(kDataSize, size);
-
-    network::memcpy(out_buffer->udp.data, data, size);
-
-    if (remote_ip == network::kIpaddrBroadcast)
-    {
-        network::memset<0xFF, network::ethernet::kAddressLength>(out_buffer->ether.dst);
-        network::memset<0xFF, network::ethernet::kAddressLength>(out_buffer->ip4.dst);
-    }
-    else if ((remote_ip & network::global::broadcast_mask) == network::global::broadcast_mask)
-    {
-        network::memset<0xFF, network::ethernet::kAddressLength>(out_buffer->ether.dst);
-        network::memcpy_ip(out_buffer->ip4.dst, remote_ip);
-    }
-    else
+    if (!GetBroadcastMulticastMac(remote_ip, out_buffer->ether.dst))
     {
-        if ((remote_ip & 0xF0) == 0xE0)
-        { // Multicast, we know the MAC Address
-            typedef union pcast32
-            {
-                uint32_t u32;
-                uint8_t u8[4];
-            } _pcast32;
-            _pcast32 multicast_ip;
-
-            multicast_ip.u32 = remote_ip;
-            s_multicast_mac[3] = multicast_ip.u8[1] & 0x7F;
-            s_multicast_mac[4] = multicast_ip.u8[2];
-            s_multicast_mac[5] = multicast_ip.u8[3];
-
-            std::memcpy(out_buffer->ether.dst, s_multicast_mac, network::ethernet::kAddressLength);
-            network::memcpy_ip(out_buffer->ip4.dst, remote_ip);
-        }
-        else
+        if constexpr (S == network::arp::EthSend::kIsNormal)
         {
-            if constexpr (S == network::arp::EthSend::kIsNormal)
-            {
-                network::arp::Send(out_buffer, size + kUdpPacketHeadersSize, remote_ip);
-            }
+            network::arp::Send(out_buffer, size + kUdpPacketHeadersSize, remote_ip);
+        }
 #if defined CONFIG_NET_ENABLE_PTP
-            else if constexpr (S == network::arp::EthSend::kIsTimestamp)
-            {
-                network::arp::SendTimestamp(out_buffer, size + kUdpPacketHeadersSize, remote_ip);
-            }
-#endif
-            return;
+        else if constexpr (S == network::arp::EthSend::kIsTimestamp)
+        {
+            network::arp::SendTimestamp(out_buffer, size + kUdpPacketHeadersSize, remote_ip);
         }
+#endif
+        return;
     }
 
+    network::memcpy_ip(out_buffer->ip4.dst, remote_ip);
+
 #if !defined(CHECKSUM_BY_HARDWARE)
     out_buffer->ip4.chksum = network::Chksum(reinterpret_cast<void*>(&out_buffer->ip4), sizeof(out_buffer->ip4));
 #endif
@@ -225,23 +391,71 @@ template <network::arp::EthSend S> static void SendImplementation(int index, con
     return;
 }
 
-int32_t Begin(uint16_t localport, UdpCallbackFunctionPtr callback)
+template <network::arp::EthSend S> static void SendImplementation(int index, const uint8_t* data, uint32_t size, uint32_t remote_ip, uint16_t remote_port)
 {
-    DEBUG_PRINTF("localport=%u", localport);
+    auto* out_buffer = reinterpret_cast<Header*>(emac_eth_send_get_dma_buffer());
 
-    for (auto i = 0; i < UDP_MAX_PORTS_ALLOWED; i++)
+    size = std::min(kDataSize, size);
+
+    network::memcpy(out_buffer->udp.data, data, size);
+
+    Transmit<S>(index, out_buffer, size, remote_ip, remote_port);
+}
+
+int32_t Begin(uint16_t localport, UdpCallbackFunctionPtr callback, Delivery delivery, uint32_t queue_depth)
+{
+    DEBUG_PRINTF("localport=%u, queue_depth=%u", localport, static_cast<unsigned int>(queue_depth));
+
+    assert(localport != 0);
+    assert(queue_depth <= UDP_MAX_QUEUE_DEPTH);
+    assert((queue_depth == 0) || (callback == nullptr));
+
+    const auto kSlot = s_hash.Slot(localport, s_ports);
+
+    if (s_hash.Get(kSlot) >= 0)
+    {
+        return s_hash.Get(kSlot);
+    }
+
+    Data* recv_data = nullptr;
+
+    if ((callback == nullptr) && (queue_depth == 0))
     {
-        auto& info = s_ports[i].info;
+        recv_data = GetRecvData(-1);
 
-        if (info.port == localport)
+        if (recv_data == nullptr)
         {
-            return i;
+#ifndef NDEBUG
+            console::Error("network::udp::Begin: UDP_MAX_POLLED_PORTS");
+#endif
+            return -1;
         }
+    }
+
+    for (auto i = 0; i < UDP_MAX_PORTS_ALLOWED; i++)
+    {
+        auto& info = s_ports[i];
 
         if (info.port == 0)
         {
+            if (recv_data != nullptr)
+            {
+                recv_data->index = i;
+                recv_data->size = 0;
+            }
+
             info.callback = callback;
             info.port = localport;
+            info.delivery = delivery;
+
+            auto& queue = s_queues[i];
+            queue.overflows = 0;
+            queue.current = UINT16_MAX;
+            queue.depth = static_cast<uint8_t>(std::min(queue_depth, static_cast<uint32_t>(UDP_MAX_QUEUE_DEPTH)));
+            queue.head = 0;
+            queue.count = 0;
+
+            s_hash.Set(kSlot, i);
 
             DEBUG_PRINTF("i=%d, localport=%d[%x], callback=%p", i, localport, localport, callback);
             return i;
@@ -258,19 +472,41 @@ int32_t End(uint16_t localport)
 {
     DEBUG_PRINTF("localport=%u[%x]", localport, localport);
 
-    for (auto i = 0; i < UDP_MAX_PORTS_ALLOWED; i++)
+    const auto kSlot = s_hash.Slot(localport, s_ports);
+    const auto kIndex = s_hash.Get(kSlot);
+
+    if (kIndex >= 0)
     {
-        auto& info = s_ports[i].info;
+        s_hash.Remove(kSlot, s_ports);
 
-        if (info.port == localport)
+        auto& info = s_ports[kIndex];
+        info.callback = nullptr;
+        info.port = 0;
+
+        for (auto& connection : s_connections)
         {
-            info.callback = nullptr;
-            info.port = 0;
+            if (connection.index == kIndex)
+            {
+                connection.index = -1;
+            }
+        }
 
-            auto& data = s_ports[i].data;
-            data.size = 0;
-            return 0;
+        auto* recv_data = GetRecvData(kIndex);
+
+        if (recv_data != nullptr)
+        {
+            recv_data->index = -1;
+            recv_data->size = 0;
+        }
+
+        auto& queue = s_queues[kIndex];
+
+        if (queue.depth != 0)
+        {
+            QueueClear(queue);
+            queue.depth = 0;
         }
+        return 0;
     }
 
 #ifndef NDEBUG
@@ -291,35 +527,249 @@ void SendWithTimestamp(int32_t index, const uint8_t* data, uint32_t size, uint32
 }
 #endif
 
+uint8_t* AcquireTx(int32_t index, uint32_t max_length)
+{
+    assert(s_tx_index < 0);
+    assert(max_length <= kDataSize);
+
+    s_tx_index = index;
+    s_tx_max_length = max_length;
+
+    auto* out_buffer = reinterpret_cast<Header*>(emac_eth_send_get_dma_buffer());
+
+    return out_buffer->udp.data;
+}
+
+void CommitTx(uint32_t length, uint32_t remote_ip, uint16_t remote_port)
+{
+    assert(s_tx_index >= 0);
+
+    const auto kIndex = s_tx_index;
+    s_tx_index = -1;
+
+    // A truncated snprintf returns the length it would have had
+    length = std::min(length, s_tx_max_length);
+
+    Transmit<network::arp::EthSend::kIsNormal>(kIndex, reinterpret_cast<Header*>(emac_eth_send_get_dma_buffer()), length, remote_ip, remote_port);
+}
+
+/*
+ * The headers as Transmit builds them, with the MAC address of the peer.
+ * Returns false when the MAC address is not in the ARP cache yet.
+ */
+static bool Build(Connection& connection)
+{
+    auto& headers = connection.headers;
+
+    if (!GetBroadcastMulticastMac(connection.remote_ip, headers.ether.dst) && !network::arp::Lookup(connection.remote_ip, headers.ether.dst))
+    {
+        return false;
+    }
+
+    // Ethernet
+    std::memcpy(headers.ether.src, netif::global::netif_default.hwaddr, network::ethernet::kAddressLength);
+    headers.ether.type = __builtin_bswap16(network::ethernet::Type::kIPv4);
+
+    // IPv4
+    headers.ip4.ver_ihl = 0x45;
+    headers.ip4.tos = 0;
+    headers.ip4.len = 0;
+    headers.ip4.id = 0;
+    headers.ip4.flags_froff = __builtin_bswap16(network::ip4::Flags::kFlagDf);
+    headers.ip4.ttl = 64;
+    headers.ip4.proto = network::ip4::Proto::kUdp;
+    headers.ip4.chksum = 0;
+    network::memcpy_ip(headers.ip4.src, netif::global::netif_default.ip.addr);
+    network::memcpy_ip(headers.ip4.dst, connection.remote_ip);
+
+    // UDP
+    headers.source_port = __builtin_bswap16(s_ports[connection.index].port);
+    headers.destination_port = __builtin_bswap16(connection.remote_port);
+
+#if !defined(CHECKSUM_BY_HARDWARE)
+    connection.sum = static_cast<uint16_t>(~network::Chksum(reinterpret_cast<void*>(&headers.ip4), sizeof(headers.ip4)));
+#endif
+    connection.arp_generation = network::arp::Generation();
+    connection.is_valid = true;
+
+    return true;
+}
+
+/*
+ * The headers are copied, only the lengths, the id and the checksum are filled in.
+ * RFC 1624: the checksum is updated for the length and the id, as these were zero.
+ */
+static void TransmitConnected(Connection& connection, Header* out_buffer, uint32_t size)
+{
+    assert(connection.index >= 0);
+    assert(size <= kDataSize);
+
+    if (__builtin_expect((!connection.is_valid || (connection.arp_generation != network::arp::Generation())), 0))
+    {
+        if (!Build(connection))
+        {
+            connection.is_valid = false;
+            Transmit<network::arp::EthSend::kIsNormal>(connection.index, out_buffer, size, connection.remote_ip, connection.remote_port);
+            return;
+        }
+    }
+
+    std::memcpy(out_buffer, &connection.headers, sizeof(struct Headers));
+
+    out_buffer->ip4.len = __builtin_bswap16(static_cast<uint16_t>(size + kIPv4UdpHeadersSize));
+    out_buffer->ip4.id = ++s_id;
+    out_buffer->udp.len = __builtin_bswap16(static_cast<uint16_t>(size + kHeaderSize));
+    out_buffer->udp.checksum = 0;
+
+#if !defined(CHECKSUM_BY_HARDWARE)
+    uint32_t sum = connection.sum + out_buffer->ip4.len + out_buffer->ip4.id;
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+    out_buffer->ip4.chksum = static_cast<uint16_t>(~sum);
+#endif
+
+    emac_eth_send(size + kUdpPacketHeadersSize);
+}
+
+int32_t Connect(int32_t index, uint32_t remote_ip, uint16_t remote_port)
+{
+    DEBUG_PRINTF("index=%d, " IPSTR ":%u", index, IP2STR(remote_ip), remote_port);
+
+    assert(index >= 0);
+    assert(index < UDP_MAX_PORTS_ALLOWED);
+    assert(s_ports[index].port != 0);
+
+    for (int32_t i = 0; i < UDP_MAX_CONNECTIONS; i++)
+    {
+        auto& connection = s_connections[i];
+
+        if (connection.index < 0)
+        {
+            connection.index = index;
+            connection.remote_ip = remote_ip;
+            connection.remote_port = remote_port;
+            connection.is_valid = false;
+            return i;
+        }
+    }
+
+#ifndef NDEBUG
+    console::Error("network::udp::Connect");
+#endif
+    return -1;
+}
+
+void Disconnect(int32_t connection)
+{
+    assert(connection >= 0);
+    assert(connection < UDP_MAX_CONNECTIONS);
+
+    s_connections[connection].index = -1;
+}
+
+void SendConnected(int32_t connection, const uint8_t* data, uint32_t size)
+{
+    assert(connection >= 0);
+    assert(connection < UDP_MAX_CONNECTIONS);
+
+    auto* out_buffer = reinterpret_cast<Header*>(emac_eth_send_get_dma_buffer());
+
+    size = std::min(kDataSize, size);
+
+    network::memcpy(out_buffer->udp.data, data, size);
+
+    TransmitConnected(s_connections[connection], out_buffer, size);
+}
+
+void CommitTxConnected(int32_t connection, uint32_t length)
+{
+    assert(connection >= 0);
+    assert(connection < UDP_MAX_CONNECTIONS);
+    assert(s_tx_index == s_connections[connection].index);
+
+    s_tx_index = -1;
+
+    length = std::min(length, s_tx_max_length);
+
+    TransmitConnected(s_connections[connection], reinterpret_cast<Header*>(emac_eth_send_get_dma_buffer()), length);
+}
+
+/*
+ * The local address, the netmask or the gateway has changed.
+ */
+void NetifChanged()
+{
+    for (auto& connection : s_connections)
+    {
+        connection.is_valid = false;
+    }
+}
+
 // Do not use - subject for removal
 uint32_t Recv(int32_t index, const uint8_t** data, uint32_t* from_ip, uint16_t* from_port)
 {
     assert(index >= 0);
     assert(index < UDP_MAX_PORTS_ALLOWED);
 
-    const auto& info = s_ports[index].info;
+    const auto& info = s_ports[index];
 
     if (__builtin_expect(info.callback != nullptr, 0))
     {
         return 0;
     }
 
-    auto& d = s_ports[index].data;
+    auto& queue = s_queues[index];
+
+    if (queue.depth != 0)
+    {
+        auto& allocator = network::memory::Allocator::Instance();
+
+        allocator.Free(queue.current);
+        queue.current = UINT16_MAX;
+
+        if (queue.count == 0)
+        {
+            return 0;
+        }
+
+        const auto& entry = queue.entries[queue.head];
+        queue.head = static_cast<uint8_t>((queue.head + 1) % queue.depth);
+        queue.count--;
+
+        uint32_t size;
+        *data = allocator.Get(entry.block, size);
+        *from_ip = entry.from_ip;
+        *from_port = entry.from_port;
+
+        queue.current = entry.block;
+
+        return size;
+    }
+
+    auto* d = GetRecvData(index);
 
-    if (__builtin_expect((d.size == 0), 1))
+    if (__builtin_expect((d == nullptr) || (d->size == 0), 1))
     {
         return 0;
     }
 
-    *data = d.data;
-    *from_ip = d.from_ip;
-    *from_port = d.from_port;
+    *data = d->data;
+    *from_ip = d->from_ip;
+    *from_port = d->from_port;
 
-    const auto kSize = d.size;
+    const auto kSize = d->size;
 
-    d.size = 0;
+    d->size = 0;
 
     return kSize;
 }
+
+uint32_t GetOverflows(int32_t index)
+{
+    assert(index >= 0);
+    assert(index < UDP_MAX_PORTS_ALLOWED);
+
+    return s_queues[index].overflows;
+}
 } // namespace network::udp
 // <---
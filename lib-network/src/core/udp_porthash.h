@@ -0,0 +1,117 @@
+/**
+ * @file udp_porthash.h
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef UDP_PORTHASH_H_
+#define UDP_PORTHASH_H_
+
+#include <cstdint>
+
+namespace network::udp
+{
+/*
+ * The destination port is looked up with open addressing and linear probing.
+ * The table is at most half full, a lookup ends after a probe or two.
+ * An entry is the index in the port table + 1, 0 is empty. The port table
+ * itself holds the port numbers, it is passed in by the caller.
+ */
+template <uint32_t kPorts> class PortHash
+{
+    static constexpr uint32_t HashBits(uint32_t n)
+    {
+        uint32_t bits = 0;
+        while ((1U << bits) < n)
+        {
+            bits++;
+        }
+        return bits;
+    }
+
+    static_assert(kPorts < 256);
+
+   public:
+    static constexpr uint32_t kBits = HashBits(2U * kPorts);
+    static constexpr uint32_t kSize = 1U << kBits;
+    static constexpr uint32_t kMask = kSize - 1;
+
+    static uint32_t Hash(uint16_t port) { return (static_cast<uint32_t>(port) * 0x9E3779B1U) >> (32U - kBits); }
+
+    /*
+     * Returns the slot holding the port, or the empty slot where it would be inserted.
+     */
+    template <typename T> uint32_t Slot(uint16_t port, const T (&ports)[kPorts]) const
+    {
+        auto slot = Hash(port);
+
+        while ((table_[slot] != 0) && (ports[table_[slot] - 1U].port != port))
+        {
+            slot = (slot + 1) & kMask;
+        }
+
+        return slot;
+    }
+
+    /*
+     * Returns the index in the port table, or -1 when the slot is empty.
+     */
+    int32_t Get(uint32_t slot) const { return static_cast<int32_t>(table_[slot]) - 1; }
+
+    void Set(uint32_t slot, int32_t index) { table_[slot] = static_cast<uint8_t>(index + 1); }
+
+    /*
+     * Backward shift deletion, no tombstones are left behind.
+     */
+    template <typename T> void Remove(uint32_t slot, const T (&ports)[kPorts])
+    {
+        auto hole = slot;
+
+        for (auto i = (slot + 1) & kMask; table_[i] != 0; i = (i + 1) & kMask)
+        {
+            const auto kHome = Hash(ports[table_[i] - 1U].port);
+
+            // The entry can fill the hole, when the hole is between its home slot and the entry
+            if (((i - kHome) & kMask) >= ((i - hole) & kMask))
+            {
+                table_[hole] = table_[i];
+                hole = i;
+            }
+        }
+
+        table_[hole] = 0;
+    }
+
+    void Clear()
+    {
+        for (auto& entry : table_)
+        {
+            entry = 0;
+        }
+    }
+
+   private:
+    uint8_t table_[kSize];
+};
+} // namespace network::udp
+
+#endif // UDP_PORTHASH_H_
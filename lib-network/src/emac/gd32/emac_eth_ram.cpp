@@ -0,0 +1,244 @@
+/**
+ * @file emac_eth_ram.cpp
+ * @brief Minimal Ethernet receive path running from RAM.
+ *
+ * While the flash bank holding the code is busy erasing or programming, the CPU cannot
+ * fetch instructions from it. This receive path runs from RAM in between, so the node keeps
+ * answering ARP requests and ping. Any other frame is left for the network stack.
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+
+#include "gd32.h"
+#include "net_config.h"
+#include "core/netif.h"
+#include "core/protocol/arp.h"
+#include "core/protocol/icmp.h"
+
+#if (defined(GD32F10X) || defined(GD32F20X)) && !defined(CONFIG_NET_ENABLE_PTP)
+/// Current receive descriptor
+extern enet_descriptors_struct* dma_current_rxdesc;
+/// Current transmit descriptor
+extern enet_descriptors_struct* dma_current_txdesc;
+
+/*
+ * Everything below is inlined in emac_eth_recv_ram, as nothing in flash can be called.
+ * Hence the byte loops instead of memcpy.
+ */
+__attribute__((always_inline)) static inline void Copy(uint8_t* dst, const uint8_t* src, uint32_t length)
+{
+    while (length-- != 0)
+    {
+        *dst++ = *src++;
+    }
+}
+
+__attribute__((always_inline)) static inline uint32_t GetIp(const uint8_t* ip)
+{
+    return static_cast<uint32_t>(ip[0]) | static_cast<uint32_t>(ip[1]) << 8 | static_cast<uint32_t>(ip[2]) << 16 | static_cast<uint32_t>(ip[3]) << 24;
+}
+
+__attribute__((always_inline)) static inline bool IsOurIp(uint32_t ip)
+{
+    return (ip == netif::global::netif_default.ip.addr) || (ip == netif::global::netif_default.secondary_ip.addr);
+}
+
+__attribute__((always_inline)) static inline bool IsArpRequestForUs(const network::arp::Header* arp)
+{
+    return (arp->arp.hardware_type == __builtin_bswap16(network::arp::kHwtypeEthernet)) && (arp->arp.protocol_type == __builtin_bswap16(network::arp::kPrtypeIPv4)) &&
+           (arp->arp.opcode == __builtin_bswap16(network::arp::OpCode::kRqstRqst)) && IsOurIp(GetIp(arp->arp.target_ip)) &&
+           (GetIp(arp->arp.sender_ip) != netif::global::netif_default.ip.addr);
+}
+
+__attribute__((always_inline)) static inline bool IsEchoRequestForUs(const network::icmp::Header* icmp)
+{
+    return (icmp->ip4.ver_ihl == 0x45) && (icmp->ip4.proto == network::ip4::Proto::kIcmp) && (icmp->icmp.type == network::icmp::Type::kEcho) &&
+           (icmp->icmp.code == network::icmp::kCodeEcho) && IsOurIp(GetIp(icmp->ip4.dst));
+}
+
+__attribute__((always_inline)) static inline void ArpReply(network::arp::Header* reply)
+{
+    Copy(reply->ether.dst, reply->ether.src, network::ethernet::kAddressLength);
+    Copy(reply->ether.src, netif::global::netif_default.hwaddr, network::ethernet::kAddressLength);
+
+    reply->arp.opcode = __builtin_bswap16(network::arp::OpCode::kRqstReply);
+
+    uint8_t ip[network::ip4::kAddressLength];
+    Copy(ip, reply->arp.target_ip, network::ip4::kAddressLength);
+
+    Copy(reply->arp.target_mac, reply->arp.sender_mac, network::ethernet::kAddressLength);
+    Copy(reply->arp.target_ip, reply->arp.sender_ip, network::ip4::kAddressLength);
+    Copy(reply->arp.sender_mac, netif::global::netif_default.hwaddr, network::ethernet::kAddressLength);
+    Copy(reply->arp.sender_ip, ip, network::ip4::kAddressLength);
+}
+
+/*
+ * The swap of the addresses keeps the IPv4 header checksum valid.
+ */
+__attribute__((always_inline)) static inline void EchoReply(network::icmp::Header* reply)
+{
+    Copy(reply->ether.dst, reply->ether.src, network::ethernet::kAddressLength);
+    Copy(reply->ether.src, netif::global::netif_default.hwaddr, network::ethernet::kAddressLength);
+
+    uint8_t ip[network::ip4::kAddressLength];
+    Copy(ip, reply->ip4.dst, network::ip4::kAddressLength);
+    Copy(reply->ip4.dst, reply->ip4.src, network::ip4::kAddressLength);
+    Copy(reply->ip4.src, ip, network::ip4::kAddressLength);
+
+    reply->icmp.type = network::icmp::Type::kEchoReply;
+#if defined(CHECKSUM_BY_HARDWARE)
+    reply->ip4.chksum = 0;
+    reply->icmp.checksum = 0;
+#else
+    // RFC 1624, only the type changed from 8 to 0
+    uint32_t sum = (~__builtin_bswap16(reply->icmp.checksum) & 0xFFFFU) + (~(network::icmp::Type::kEcho << 8) & 0xFFFFU);
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+    reply->icmp.checksum = __builtin_bswap16(static_cast<uint16_t>(~sum));
+#endif
+}
+
+/*
+ * Returns false when the frame is not an ARP request or a ping for us.
+ */
+__attribute__((always_inline)) static inline bool Reply(const enet_descriptors_struct* rxdesc, uint32_t status, enet_descriptors_struct* txdesc)
+{
+    const auto* const kFrame = reinterpret_cast<const uint8_t*>(rxdesc->buffer1_addr);
+    const auto* const kEther = reinterpret_cast<const network::ethernet::Header*>(kFrame);
+    auto* reply = reinterpret_cast<uint8_t*>(txdesc->buffer1_addr);
+    uint32_t length;
+
+    if (kEther->type == __builtin_bswap16(network::ethernet::Type::kArp))
+    {
+        if (!IsArpRequestForUs(reinterpret_cast<const network::arp::Header*>(kFrame)))
+        {
+            return false;
+        }
+
+        length = sizeof(struct network::arp::Header);
+        Copy(reply, kFrame, length);
+        ArpReply(reinterpret_cast<network::arp::Header*>(reply));
+    }
+    else if (kEther->type == __builtin_bswap16(network::ethernet::Type::kIPv4))
+    {
+        const auto* const kIcmp = reinterpret_cast<const network::icmp::Header*>(kFrame);
+
+        if (!IsEchoRequestForUs(kIcmp))
+        {
+            return false;
+        }
+
+        length = sizeof(struct network::ethernet::Header) + __builtin_bswap16(kIcmp->ip4.len);
+
+        // The frame length includes the CRC
+        if ((length + 4U) > GET_RDES0_FRML(status))
+        {
+            return false;
+        }
+
+        Copy(reply, kFrame, length);
+        EchoReply(reinterpret_cast<network::icmp::Header*>(reply));
+    }
+    else
+    {
+        return false;
+    }
+
+    // Transmit, as emac_eth_send without timestamping
+    txdesc->control_buffer_size = length;
+    txdesc->status = (txdesc->status & ~ENET_TDES0_TTSEN) | ENET_TDES0_LSG | ENET_TDES0_FSG | ENET_TDES0_DAV;
+
+    const auto kDmaTxFlags = ENET_DMA_STAT & (ENET_DMA_STAT_TBU | ENET_DMA_STAT_TU);
+
+    if (kDmaTxFlags != 0)
+    {
+        ENET_DMA_STAT = kDmaTxFlags;
+        ENET_DMA_TPEN = 0;
+    }
+
+    dma_current_txdesc = reinterpret_cast<enet_descriptors_struct*>(txdesc->buffer2_next_desc_addr);
+
+    return true;
+}
+
+/**
+ * @brief Answers an ARP request or ping waiting in the receive descriptors.
+ *
+ * The received frames are walked in order, so a frame for the network stack at the head
+ * does not hold back the answers. A frame that is handled at the head is released. Further
+ * on it must stay in its place, its type is cleared and the network stack drops it.
+ * Any other frame stays for emac_eth_recv.
+ * When the transmit descriptor is still in use, the frames are left for the next call.
+ */
+RAMFUNC void emac_eth_recv_ram()
+{
+    auto* txdesc = dma_current_txdesc;
+
+    if ((txdesc->status & ENET_TDES0_DAV) != 0)
+    {
+        return;
+    }
+
+    auto* rxdesc = dma_current_rxdesc;
+
+    do
+    {
+        const auto kStatus = rxdesc->status;
+
+        if ((kStatus & ENET_RDES0_DAV) != 0)
+        {
+            return;
+        }
+
+        const auto kIsFrame = ((kStatus & (ENET_RDES0_FDES | ENET_RDES0_LDES)) == (ENET_RDES0_FDES | ENET_RDES0_LDES)) && ((kStatus & ENET_RDES0_ERRS) == 0);
+
+        if (kIsFrame && Reply(rxdesc, kStatus, txdesc))
+        {
+            if (rxdesc != dma_current_rxdesc)
+            {
+                reinterpret_cast<network::ethernet::Header*>(rxdesc->buffer1_addr)->type = 0;
+                return;
+            }
+
+            // Release, as emac_free_pkt
+            rxdesc->status = ENET_RDES0_DAV;
+
+            if ((ENET_DMA_STAT & ENET_DMA_STAT_RBU) != 0)
+            {
+                ENET_DMA_STAT = ENET_DMA_STAT_RBU;
+                ENET_DMA_RPEN = 0;
+            }
+
+            dma_current_rxdesc = reinterpret_cast<enet_descriptors_struct*>(rxdesc->buffer2_next_desc_addr);
+            return;
+        }
+
+        rxdesc = reinterpret_cast<enet_descriptors_struct*>(rxdesc->buffer2_next_desc_addr);
+    } while (rxdesc != dma_current_rxdesc);
+}
+#else
+/**
+ * @brief Not available, the frames are handled by the network stack when the flash is ready.
+ */
+void emac_eth_recv_ram() {}
+#endif
@@ -0,0 +1,230 @@
+/**
+ * @file bench_udp_demux.cpp
+ *
+ */
+/* Copyright (C) 2025 by Arjan van Vught mailto:info@gd32-dmx.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark of the UDP destination port lookup, the hash table against the linear scan it replaced.
+ * udp.cpp cannot be built on the host, the hash table is the one of network::udp, with a port table
+ * of the same shape. A random sequence of Begin and End is checked against a reference map first.
+ *
+ * cd lib-network/test
+ * g++ -std=c++20 -O2 -Wall -Wextra -Werror bench_udp_demux.cpp -o bench_udp_demux && ./bench_udp_demux
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <map>
+#include <random>
+
+#include "../src/core/udp_porthash.h"
+
+#define UDP_MAX_PORTS_ALLOWED 32
+
+namespace udp
+{
+struct PortInfo
+{
+    void* callback;
+    uint16_t port;
+};
+
+static PortInfo s_ports[UDP_MAX_PORTS_ALLOWED];
+static network::udp::PortHash<UDP_MAX_PORTS_ALLOWED> s_hash;
+
+static int32_t Begin(uint16_t port)
+{
+    const auto kSlot = s_hash.Slot(port, s_ports);
+
+    if (s_hash.Get(kSlot) >= 0)
+    {
+        return s_hash.Get(kSlot);
+    }
+
+    for (int32_t i = 0; i < UDP_MAX_PORTS_ALLOWED; i++)
+    {
+        if (s_ports[i].port == 0)
+        {
+            s_ports[i].port = port;
+            s_hash.Set(kSlot, i);
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int32_t End(uint16_t port)
+{
+    const auto kSlot = s_hash.Slot(port, s_ports);
+    const auto kIndex = s_hash.Get(kSlot);
+
+    if (kIndex < 0)
+    {
+        return -1;
+    }
+
+    s_hash.Remove(kSlot, s_ports);
+    s_ports[kIndex].port = 0;
+
+    return 0;
+}
+
+static void Clear()
+{
+    for (auto& port : s_ports)
+    {
+        port.port = 0;
+    }
+
+    s_hash.Clear();
+}
+
+__attribute__((noinline)) static int32_t LookupHash(uint16_t port)
+{
+    return s_hash.Get(s_hash.Slot(port, s_ports));
+}
+
+/*
+ * The lookup before the hash table.
+ */
+__attribute__((noinline)) static int32_t LookupLinear(uint16_t port)
+{
+    for (int32_t i = 0; i < UDP_MAX_PORTS_ALLOWED; i++)
+    {
+        if (s_ports[i].port == port)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+} // namespace udp
+
+namespace bench
+{
+static constexpr uint32_t kLookups = 50000000;
+
+static bool Model()
+{
+    std::mt19937 rng(1);
+    std::map<uint16_t, int32_t> reference;
+
+    for (uint32_t n = 0; n < 2000000; n++)
+    {
+        const auto kPort = static_cast<uint16_t>(1 + rng() % 200);
+
+        if ((rng() % 2) != 0)
+        {
+            const auto kIndex = udp::Begin(kPort);
+
+            if (reference.count(kPort) != 0)
+            {
+                if (kIndex != reference[kPort])
+                {
+                    return false;
+                }
+            }
+            else if (kIndex >= 0)
+            {
+                reference[kPort] = kIndex;
+            }
+            else if (reference.size() != UDP_MAX_PORTS_ALLOWED)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            const auto kResult = udp::End(kPort);
+
+            if (kResult != (reference.erase(kPort) != 0 ? 0 : -1))
+            {
+                return false;
+            }
+        }
+
+        if ((n % 97) == 0)
+        {
+            for (uint16_t port = 1; port <= 200; port++)
+            {
+                if (udp::LookupHash(port) != ((reference.count(port) != 0) ? reference[port] : -1))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+typedef int32_t (*Lookup)(uint16_t port);
+
+static double Run(Lookup lookup, uint16_t port)
+{
+    volatile int32_t sink = 0;
+
+    const auto kStart = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < kLookups; i++)
+    {
+        sink = sink + lookup(port);
+    }
+
+    const std::chrono::duration<double, std::nano> kNanos = std::chrono::steady_clock::now() - kStart;
+
+    return kNanos.count() / kLookups;
+}
+} // namespace bench
+
+int main()
+{
+    if (!bench::Model())
+    {
+        puts("FAIL: hash table differs from the reference");
+        return 1;
+    }
+
+    puts("open ports   linear scan   hash");
+
+    for (const uint32_t kPorts : {1U, 8U, 32U})
+    {
+        udp::Clear();
+
+        uint16_t last = 0;
+
+        for (uint32_t i = 0; i < kPorts; i++)
+        {
+            last = static_cast<uint16_t>(5000 + i * 7 + (i % 3) * 1000);
+            udp::Begin(last);
+        }
+
+        // The last opened port is the worst case for the linear scan
+        printf("%10u   %8.1f ns   %4.1f ns\n", static_cast<unsigned int>(kPorts), bench::Run(udp::LookupLinear, last), bench::Run(udp::LookupHash, last));
+    }
+
+    return 0;
+}
@@ -101,6 +101,12 @@ class RemoteConfig
     void HandleDisplayGet();
     void HandleTftpSet();
     void HandleTftpGet();
+#if defined(ENABLE_TFTP_SERVER) && defined(CONFIG_TFTP_MULTICAST)
+    void HandleTftpMulticastSet();
+#endif
+#if defined(ENABLE_TFTP_SERVER)
+    void HandleUpdate();
+#endif
 
     void PlatformHandleTftpSet();
     void PlatformHandleTftpGet();
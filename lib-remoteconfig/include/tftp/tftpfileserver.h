@@ -33,6 +33,7 @@
 
 #if defined(GD32)
 #include "gd32.h"
+#include "firmwaretrailer.h"
 #endif
 
 namespace tftpfileserver
@@ -46,22 +47,35 @@ class TFTPFileServer final : public TFTPDaemon
     TFTPFileServer(uint8_t* buffer, uint32_t size);
     ~TFTPFileServer() override {}
 
-    bool FileOpen(const char* file_name, tftp::Mode mode) override;
-    bool FileCreate(const char* file_name, tftp::Mode mode) override;
-    bool FileClose() override;
-    size_t FileRead(void* buffer, size_t count, unsigned block_number) override;
-    size_t FileWrite(const void* buffer, size_t count, unsigned block_number) override;
+    bool FileOpen(uint32_t session, const char* file_name, tftp::Mode mode) override;
+    bool FileCreate(uint32_t session, const char* file_name, tftp::Mode mode) override;
+    bool FileClose(uint32_t session) override;
+    void FileAbort(uint32_t session) override;
+    bool FileAllocate(uint32_t session, uint32_t file_size) override;
+    uint32_t FileSize(uint32_t session) override;
+    size_t FileRead(uint32_t session, void* buffer, size_t count, unsigned block_number, size_t block_size) override;
+    size_t FileWrite(uint32_t session, const void* buffer, size_t count, unsigned block_number, size_t block_size) override;
     void Exit() override;
 
     uint32_t GetFileSize() const { return m_nFileSize; }
 
     bool IsDone() const { return m_bDone; }
 
+   private:
+    void TransferEnd();
+
    private:
     uint8_t* buffer_;
     uint32_t m_nSize;
     uint32_t m_nFileSize{0};
+    uint32_t m_nReadSize{0};
+    int32_t write_session_{-1}; ///< The firmware is written by a single session
+    int32_t read_session_{-1}; ///< The firmware is read back by a single session, not during a write
+    tftp::Statistics statistics_begin_{}; ///< Of the daemon, when the write session was created
     bool m_bDone{false};
+#if defined(GD32)
+    firmware::trailer::Check check_;
+#endif
 };
 
 #endif  // TFTP_TFTPFILESERVER_H_
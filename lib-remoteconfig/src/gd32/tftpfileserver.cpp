@@ -23,10 +23,42 @@
  * THE SOFTWARE.
  */
 
+#include <cstdint>
+#include <cstring>
+
+#include "tftp/tftpfileserver.h"
+#include "firmware.h"
+#include "lz4decoder.h"
+#include "firmwarepatch.h"
+
+#include "firmware/debug/debug_debug.h"
+
 namespace tftpfileserver
 {
-bool is_valid([[maybe_unused]] const void* pBuffer)
+/*
+ * The first block starts with the vector table, the reset handler must be in the image.
+ * The image as a whole is checked with the trailer, when the last block has arrived.
+ * A compressed image starts with the LZ4 frame instead, and a patch with its header.
+ * These are checked while the image is decompressed or patched.
+ */
+bool is_valid(const void* pBuffer)
 {
+    if (firmware::lz4::IsFrame(reinterpret_cast<const uint8_t*>(pBuffer), 4) || firmware::patch::IsPatch(reinterpret_cast<const uint8_t*>(pBuffer), 4))
+    {
+        return true;
+    }
+
+    uint32_t vectors[2];
+    memcpy(vectors, pBuffer, sizeof(vectors));
+
+    const auto kResetHandler = vectors[1];
+
+    if (((kResetHandler & 0x1) == 0) || (kResetHandler < (FLASH_BASE + OFFSET_UIMAGE)) || (kResetHandler >= (FLASH_BASE + OFFSET_UIMAGE + FIRMWARE_MAX_SIZE)))
+    {
+        DEBUG_PRINTF("Reset handler %x is not in the image", static_cast<unsigned int>(kResetHandler));
+        return false;
+    }
+
     return true;
 }
 } // namespace tftpfileserver
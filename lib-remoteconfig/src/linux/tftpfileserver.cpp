@@ -41,31 +41,48 @@ void TFTPFileServer::Exit() {
 	DEBUG_EXIT();
 }
 
-bool TFTPFileServer::FileOpen([[maybe_unused]] const char* pFileName, [[maybe_unused]] tftp::Mode mode) {
+bool TFTPFileServer::FileOpen([[maybe_unused]] uint32_t nSession, [[maybe_unused]] const char* pFileName, [[maybe_unused]] tftp::Mode mode) {
 	DEBUG_ENTRY();
 	DEBUG_EXIT();
 	return false;
 }
 
-bool TFTPFileServer::FileCreate([[maybe_unused]] const char* pFileName, [[maybe_unused]] tftp::Mode mode) {
+bool TFTPFileServer::FileCreate([[maybe_unused]] uint32_t nSession, [[maybe_unused]] const char* pFileName, [[maybe_unused]] tftp::Mode mode) {
 	DEBUG_ENTRY();
 	DEBUG_EXIT();
 	return false;
 }
 
-bool TFTPFileServer::FileClose() {
+bool TFTPFileServer::FileClose([[maybe_unused]] uint32_t nSession) {
 	DEBUG_ENTRY();
 	DEBUG_EXIT();
 	return false;
 }
 
-size_t TFTPFileServer::FileRead([[maybe_unused]] void* pBuffer, [[maybe_unused]] size_t nCount, [[maybe_unused]] unsigned nBlockNumber) {
+void TFTPFileServer::FileAbort([[maybe_unused]] uint32_t nSession) {
+	DEBUG_ENTRY();
+	DEBUG_EXIT();
+}
+
+bool TFTPFileServer::FileAllocate([[maybe_unused]] uint32_t nSession, [[maybe_unused]] uint32_t nFileSize) {
+	DEBUG_ENTRY();
+	DEBUG_EXIT();
+	return false;
+}
+
+uint32_t TFTPFileServer::FileSize([[maybe_unused]] uint32_t nSession) {
+	DEBUG_ENTRY();
+	DEBUG_EXIT();
+	return 0;
+}
+
+size_t TFTPFileServer::FileRead([[maybe_unused]] uint32_t nSession, [[maybe_unused]] void* pBuffer, [[maybe_unused]] size_t nCount, [[maybe_unused]] unsigned nBlockNumber, [[maybe_unused]] size_t nBlockSize) {
 	DEBUG_ENTRY();
 	DEBUG_EXIT();
 	return 0;
 }
 
-size_t TFTPFileServer::FileWrite([[maybe_unused]] const void *pBuffer, [[maybe_unused]] size_t nCount, [[maybe_unused]] unsigned nBlockNumber) {
+size_t TFTPFileServer::FileWrite([[maybe_unused]] uint32_t nSession, [[maybe_unused]] const void *pBuffer, [[maybe_unused]] size_t nCount, [[maybe_unused]] unsigned nBlockNumber, [[maybe_unused]] size_t nBlockSize) {
 	DEBUG_ENTRY();
 	DEBUG_EXIT();
 	return 0;
@@ -43,6 +43,13 @@
 #endif
 #include "display.h"
 #include "configstore.h"
+#if defined(ENABLE_TFTP_SERVER) && defined(CONFIG_TFTP_MULTICAST)
+#include "ip4/ip4_helpers.h"
+#include "firmware.h"
+#endif
+#if defined(ENABLE_TFTP_SERVER)
+#include "updatestatistics.h"
+#endif
 #include "firmware/debug/debug_dump.h"
  #include "firmware/debug/debug_debug.h"
 
@@ -61,7 +68,10 @@ enum class Command
     kUptime,
 #endif
     kTftp,
-    kFactory
+    kFactory,
+#if defined(ENABLE_TFTP_SERVER)
+    kUpdate
+#endif
 };
 } // namespace get
 namespace set
@@ -69,7 +79,10 @@ namespace set
 enum class Command
 {
     kTftp,
-    kDisplay
+    kDisplay,
+#if defined(ENABLE_TFTP_SERVER) && defined(CONFIG_TFTP_MULTICAST)
+    kTftpMulticast
+#endif
 };
 } // namespace set
 } // namespace remoteconfig::udp
@@ -82,13 +95,19 @@ constexpr struct RemoteConfig::Commands RemoteConfig::kGet[] = {
 #if !defined(CONFIG_REMOTECONFIG_MINIMUM)
     {&RemoteConfig::HandleUptime, "uptime#", 7, false}, //
 #endif
-    {&RemoteConfig::HandleTftpGet, "tftp#", 5, false},    //
-    {&RemoteConfig::HandleFactory, "factory##", 9, false} //
+    {&RemoteConfig::HandleTftpGet, "tftp#", 5, false},     //
+    {&RemoteConfig::HandleFactory, "factory##", 9, false}, //
+#if defined(ENABLE_TFTP_SERVER)
+    {&RemoteConfig::HandleUpdate, "update#", 7, false} //
+#endif
 };
 
 constexpr struct RemoteConfig::Commands RemoteConfig::kSet[] = {
-    {&RemoteConfig::HandleTftpSet, "tftp#", 5, true},      //
-    {&RemoteConfig::HandleDisplaySet, "display#", 8, true} //
+    {&RemoteConfig::HandleTftpSet, "tftp#", 5, true},       //
+    {&RemoteConfig::HandleDisplaySet, "display#", 8, true}, //
+#if defined(ENABLE_TFTP_SERVER) && defined(CONFIG_TFTP_MULTICAST)
+    {&RemoteConfig::HandleTftpMulticastSet, "mtftp#", 6, true} //
+#endif
 };
 
 static constexpr char kOutput[static_cast<uint32_t>(remoteconfig::Output::LAST)][12] = {"DMX",     "RDM",    "Monitor", "Pixel",  "TimeCode",  "OSC", "Config",
@@ -266,9 +285,26 @@ void RemoteConfig::HandleUptime()
     DEBUG_ENTRY();
 
     const auto kUptime = hal::Uptime();
-    const auto kLength = snprintf(udp_buffer_, remoteconfig::udp::kBufferSize - 1, "uptime: %us\n", static_cast<unsigned int>(kUptime));
+    auto* reply = reinterpret_cast<char*>(network::udp::AcquireTx(handle_, remoteconfig::udp::kBufferSize));
+    const auto kLength = snprintf(reply, remoteconfig::udp::kBufferSize - 1, "uptime: %us\n", static_cast<unsigned int>(kUptime));
+
+    network::udp::CommitTx(static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
+
+    DEBUG_EXIT();
+}
+#endif
+
+#if defined(ENABLE_TFTP_SERVER)
+/*
+ * The results of the last firmware update, kept until the next one.
+ */
+void RemoteConfig::HandleUpdate()
+{
+    DEBUG_ENTRY();
 
-    network::udp::Send(handle_, reinterpret_cast<const uint8_t*>(udp_buffer_), static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
+    auto* reply = reinterpret_cast<char*>(network::udp::AcquireTx(handle_, remoteconfig::udp::kBufferSize));
+    const auto kLength = firmware::update::Format(reply, remoteconfig::udp::kBufferSize - 1);
+    network::udp::CommitTx(kLength, ip_from_, remoteconfig::udp::kPort);
 
     DEBUG_EXIT();
 }
@@ -279,8 +315,9 @@ void RemoteConfig::HandleVersion()
     DEBUG_ENTRY();
 
     const auto* p = FirmwareVersion::Get()->GetPrint();
-    const auto kLength = snprintf(udp_buffer_, remoteconfig::udp::kBufferSize - 1, "version:%s\n", p);
-    network::udp::Send(handle_, reinterpret_cast<const uint8_t*>(udp_buffer_), static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
+    auto* reply = reinterpret_cast<char*>(network::udp::AcquireTx(handle_, remoteconfig::udp::kBufferSize));
+    const auto kLength = snprintf(reply, remoteconfig::udp::kBufferSize - 1, "version:%s\n", p);
+    network::udp::CommitTx(static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
 
     DEBUG_EXIT();
 }
@@ -289,15 +326,16 @@ void RemoteConfig::HandleList()
 {
     DEBUG_ENTRY();
 
-    constexpr auto kCmdLength = kGet[static_cast<uint32_t>(remoteconfig::udp::get::Command::kList)].kLength;
-    auto* list_response = &udp_buffer_[kCmdLength + 2U];
-    const auto kListResponseBufferLength = remoteconfig::udp::kBufferSize - (kCmdLength + 2U);
     int32_t list_length;
 
     uint8_t display_name[common::store::remoteconfig::kDisplayNameLength];
     ConfigStore::Instance().RemoteConfigCopyArray(display_name, &common::store::RemoteConfig::display_name);
     display_name[common::store::remoteconfig::kDisplayNameLength - 1] = '\0'; // Just to be safe
 
+    // The reply is formatted in the transmit DMA buffer
+    auto* list_response = reinterpret_cast<char*>(network::udp::AcquireTx(handle_, remoteconfig::udp::kBufferSize));
+    const auto kListResponseBufferLength = remoteconfig::udp::kBufferSize;
+
 #if !defined(CONFIG_REMOTECONFIG_MINIMUM)
     const auto* const kNodeTypeName = dmxnode::GetNodeType(dmxnode::kNodeType);
 #else
@@ -315,7 +353,7 @@ void RemoteConfig::HandleList()
                                kOutput[static_cast<uint32_t>(output_)], static_cast<unsigned int>(active_outputs_));
     }
 
-    network::udp::Send(handle_, reinterpret_cast<const uint8_t*>(list_response), static_cast<uint32_t>(list_length), ip_from_, remoteconfig::udp::kPort);
+    network::udp::CommitTx(static_cast<uint32_t>(list_length), ip_from_, remoteconfig::udp::kPort);
 
     DEBUG_EXIT();
 }
@@ -343,9 +381,10 @@ void RemoteConfig::HandleDisplayGet()
     DEBUG_ENTRY();
 
     const bool kIsOn = !(Display::Get()->IsSleep());
-    const auto kLength = snprintf(udp_buffer_, remoteconfig::udp::kBufferSize - 1, "display:%s\n", kIsOn ? "On" : "Off");
+    auto* reply = reinterpret_cast<char*>(network::udp::AcquireTx(handle_, remoteconfig::udp::kBufferSize));
+    const auto kLength = snprintf(reply, remoteconfig::udp::kBufferSize - 1, "display:%s\n", kIsOn ? "On" : "Off");
 
-    network::udp::Send(handle_, reinterpret_cast<const uint8_t*>(udp_buffer_), static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
+    network::udp::CommitTx(static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
 
     DEBUG_EXIT();
 }
@@ -354,12 +393,10 @@ void RemoteConfig::TftpExit()
 {
     DEBUG_ENTRY();
 
-    const auto kCmdLength = kSet[static_cast<uint32_t>(remoteconfig::udp::set::Command::kTftp)].kLength;
+    // Called by the TFTP server, there is no received command in udp_buffer_
+    enable_tftp_ = false;
 
-    bytes_received_ = kCmdLength + 1U;
-    udp_buffer_[kCmdLength + 1] = '0';
-
-    HandleTftpSet();
+    PlatformHandleTftpSet();
 
     DEBUG_EXIT();
 }
@@ -378,6 +415,9 @@ void RemoteConfig::HandleTftpSet()
 
     enable_tftp_ = (udp_buffer_[kCmdLength + 1U] != '0');
 
+    // A buffered firmware is written to the flash now, that takes a while
+    network::udp::Release();
+
     if (enable_tftp_)
     {
         Display::Get()->SetSleep(false);
@@ -388,14 +428,50 @@ void RemoteConfig::HandleTftpSet()
     DEBUG_EXIT();
 }
 
+#if defined(ENABLE_TFTP_SERVER) && defined(CONFIG_TFTP_MULTICAST)
+/*
+ * !mtftp#<server ip>
+ * The firmware is read from a multicast TFTP server (RFC 2090), received by all nodes at once.
+ */
+void RemoteConfig::HandleTftpMulticastSet()
+{
+    DEBUG_ENTRY();
+
+    constexpr auto kCmdLength = kSet[static_cast<uint32_t>(remoteconfig::udp::set::Command::kTftpMulticast)].kLength;
+
+    const auto kServerIp = net::ParseIpString(&udp_buffer_[kCmdLength + 1U], bytes_received_ - kCmdLength);
+
+    if (kServerIp == 0)
+    {
+        DEBUG_EXIT();
+        return;
+    }
+
+    enable_tftp_ = true;
+    Display::Get()->SetSleep(false);
+
+    network::udp::Release();
+
+    PlatformHandleTftpSet();
+
+    if ((tftp_file_server_ == nullptr) || !tftp_file_server_->MulticastRequest(kServerIp, firmware::FILE_NAME))
+    {
+        Display::Get()->TextStatus("Error: TFTP", console::Colours::kConsoleRed);
+    }
+
+    DEBUG_EXIT();
+}
+#endif
+
 void RemoteConfig::HandleTftpGet()
 {
     DEBUG_ENTRY();
 
     PlatformHandleTftpGet();
 
-    const auto kLength = snprintf(udp_buffer_, remoteconfig::udp::kBufferSize - 1, "tftp:%s\n", enable_tftp_ ? "On" : "Off");
-    network::udp::Send(handle_, reinterpret_cast<const uint8_t*>(udp_buffer_), static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
+    auto* reply = reinterpret_cast<char*>(network::udp::AcquireTx(handle_, remoteconfig::udp::kBufferSize));
+    const auto kLength = snprintf(reply, remoteconfig::udp::kBufferSize - 1, "tftp:%s\n", enable_tftp_ ? "On" : "Off");
+    network::udp::CommitTx(static_cast<uint32_t>(kLength), ip_from_, remoteconfig::udp::kPort);
 
     DEBUG_EXIT();
 }
@@ -36,12 +36,18 @@
 #include "tftp/tftpfileserver.h"
 #include "flashcodeinstall.h"
 #include "firmware.h"
+#include "updatestatistics.h"
 
 #include "display.h"
 
  #include "firmware/debug/debug_debug.h"
 
+#if defined(CONFIG_FLASHCODEINSTALL_STREAMING) || defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
+// The firmware is programmed while it arrives, or staged in the SPI flash
+static constexpr uint8_t* s_tftp_buffer = nullptr;
+#else
 static uint8_t s_tftp_buffer[FIRMWARE_MAX_SIZE];
+#endif
 
 void RemoteConfig::PlatformHandleTftpSet()
 {
@@ -55,20 +61,25 @@ void RemoteConfig::PlatformHandleTftpSet()
     }
     else if (!enable_tftp_ && (tftp_file_server_ != nullptr))
     {
-        const uint32_t kFileSize = tftp_file_server_->GetFileSize();
-        DEBUG_PRINTF("kFileSize=%d, %d", kFileSize, tftp_file_server_->IsDone());
+        DEBUG_PRINTF("GetFileSize()=%d, %d", tftp_file_server_->GetFileSize(), tftp_file_server_->IsDone());
 
         bool bSucces = true;
 
+#if !defined(CONFIG_FLASHCODEINSTALL_STREAMING) && !defined(CONFIG_FLASHCODEINSTALL_SPI_STAGING)
         if (tftp_file_server_->IsDone())
         {
+            const uint32_t kFileSize = tftp_file_server_->GetFileSize();
+
+            firmware::update::InstallBegin();
             bSucces = FlashCodeInstall::Get()->WriteFirmware(s_tftp_buffer, kFileSize);
+            firmware::update::End(bSucces, FlashCodeInstall::Get()->GetImageSize());
 
             if (!bSucces)
             {
                 Display::Get()->TextStatus("Error: TFTP", console::Colours::kConsoleRed);
             }
         }
+#endif
 
         delete tftp_file_server_;
         tftp_file_server_ = nullptr;
@@ -35,16 +35,20 @@
 #include "tftp/tftpfileserver.h"
 #include "remoteconfig.h"
 #include "display.h"
+#include "flashcodeinstall.h"
 #include "firmware.h"
+#include "updatestatistics.h"
 
  #include "firmware/debug/debug_debug.h"
 
 using namespace tftpfileserver;
 
+/*
+ * Without a buffer, the firmware is streamed into the flash while it arrives.
+ */
 TFTPFileServer::TFTPFileServer(uint8_t *pBuffer, uint32_t nSize): buffer_(pBuffer), m_nSize(nSize) {
 	DEBUG_ENTRY();
 
-	assert(buffer_ != nullptr);
 	assert(nSize != 0);
 
 	DEBUG_EXIT();
@@ -59,18 +63,89 @@ void TFTPFileServer::Exit() {
 }
 
 
-bool TFTPFileServer::FileOpen([[maybe_unused]] const char *pFileName, [[maybe_unused]] tftp::Mode tMode) {
+/*
+ * RRQ of the installed firmware, on GD32 it is read from the memory-mapped flash.
+ */
+bool TFTPFileServer::FileOpen([[maybe_unused]] uint32_t nSession, [[maybe_unused]] const char *pFileName, [[maybe_unused]] tftp::Mode mode) {
 	DEBUG_ENTRY();
 
+#if defined (GD32)
+	assert(pFileName != nullptr);
+
+	if (mode != tftp::Mode::kBinary) {
+		DEBUG_EXIT();
+		return false;
+	}
+
+	if (strncmp(firmware::FILE_NAME, pFileName, firmware::FILE_NAME_LENGTH) != 0) {
+		DEBUG_EXIT();
+		return false;
+	}
+
+	if ((write_session_ >= 0) || (read_session_ >= 0)) {
+		// The flash is being programmed, or read back by another session
+		DEBUG_EXIT();
+		return false;
+	}
+
+	/*
+	 * The end of the firmware is the end of its trailer. A differential install leaves the
+	 * sectors of the previous image beyond a shorter one, so the flash is not searched for
+	 * the last word that is not erased.
+	 */
+	const auto *const pImage = reinterpret_cast<const uint8_t *>(FLASH_BASE + OFFSET_UIMAGE);
+
+	m_nReadSize = firmware::trailer::GetSize(pImage, FIRMWARE_MAX_SIZE - static_cast<uint32_t>(sizeof(struct firmware::trailer::Record)));
+
+	if (m_nReadSize == 0) {
+		/*
+		 * An image from before the trailer was introduced, it was installed on an erased
+		 * firmware area. It ends at the last word that is not erased, before the boot record.
+		 */
+		const auto *const pBegin = reinterpret_cast<const uint32_t *>(pImage);
+		const auto *pEnd = pBegin + ((FIRMWARE_MAX_SIZE - sizeof(struct firmware::trailer::Record)) / 4);
+
+		while ((pEnd > pBegin) && (pEnd[-1] == 0xFFFFFFFF)) {
+			pEnd--;
+		}
+
+		m_nReadSize = static_cast<uint32_t>(pEnd - pBegin) * 4;
+	}
+
+	DEBUG_PRINTF("m_nReadSize=%u", m_nReadSize);
+
+	if (m_nReadSize == 0) {
+		DEBUG_EXIT();
+		return false;
+	}
+
+	read_session_ = static_cast<int32_t>(nSession);
+
+	DEBUG_EXIT();
+	return true;
+#else
 	DEBUG_EXIT();
 	return false;
+#endif
 }
 
-bool TFTPFileServer::FileCreate(const char* pFileName, tftp::Mode mode) {
+bool TFTPFileServer::FileCreate(uint32_t nSession, const char* pFileName, tftp::Mode mode) {
 	DEBUG_ENTRY();
 
 	assert(pFileName != nullptr);
 
+	if (write_session_ >= 0) {
+		// The firmware is already being written by another session
+		DEBUG_EXIT();
+		return false;
+	}
+
+	if (read_session_ >= 0) {
+		// The firmware is being read back, the flash must not change underneath
+		DEBUG_EXIT();
+		return false;
+	}
+
 	if (mode != tftp::Mode::kBinary) {
 		DEBUG_EXIT();
 		return false;
@@ -84,14 +159,80 @@ bool TFTPFileServer::FileCreate(const char* pFileName, tftp::Mode mode) {
 	Display::Get()->TextStatus("TFTP Started", console::Colours::kConsoleGreen);
 
 	m_nFileSize = 0;
+	m_bDone = false;
+	write_session_ = static_cast<int32_t>(nSession);
+	statistics_begin_ = GetStatistics();
+
+	firmware::update::Begin();
+#if defined (GD32)
+	check_.Reset();
+#endif
+
+	if (buffer_ == nullptr) {
+		FlashCodeInstall::Get()->StreamBegin();
+	}
 
 	DEBUG_EXIT();
 	return (true);
 }
 
-bool TFTPFileServer::FileClose() {
+bool TFTPFileServer::FileClose(uint32_t nSession) {
 	DEBUG_ENTRY();
 
+	if (static_cast<int32_t>(nSession) == read_session_) {
+		read_session_ = -1;
+		DEBUG_EXIT();
+		return true;
+	}
+
+	if (static_cast<int32_t>(nSession) != write_session_) {
+		DEBUG_EXIT();
+		return true;
+	}
+
+	write_session_ = -1;
+
+	TransferEnd();
+
+#if defined (GD32)
+	const auto bIsValid = check_.IsValid();
+
+	if (!bIsValid) {
+		puts("Error: firmware trailer or CRC");
+	}
+
+	if (buffer_ == nullptr) {
+		// The read-back CRC is done straight from the flash, a compressed file is larger once installed
+		const auto bIsInstalled = FlashCodeInstall::Get()->StreamEnd() && bIsValid && FlashCodeInstall::Get()->VerifyImage(FlashCodeInstall::Get()->GetImageSize());
+
+		firmware::update::End(bIsInstalled, FlashCodeInstall::Get()->GetImageSize());
+
+		if (!bIsInstalled) {
+			FlashCodeInstall::Get()->Invalidate();
+			Display::Get()->TextStatus("Error: TFTP", console::Colours::kConsoleRed);
+			DEBUG_EXIT();
+			return false;
+		}
+	} else if (!bIsValid) {
+		firmware::update::End(false, 0);
+		Display::Get()->TextStatus("Error: TFTP", console::Colours::kConsoleRed);
+		DEBUG_EXIT();
+		return false;
+	}
+#else
+	if (buffer_ == nullptr) {
+		const auto bIsInstalled = FlashCodeInstall::Get()->StreamEnd();
+
+		firmware::update::End(bIsInstalled, FlashCodeInstall::Get()->GetImageSize());
+
+		if (!bIsInstalled) {
+			Display::Get()->TextStatus("Error: TFTP", console::Colours::kConsoleRed);
+			DEBUG_EXIT();
+			return false;
+		}
+	}
+#endif
+
 	m_bDone = true;
 
 	Display::Get()->TextStatus("TFTP Ended", console::Colours::kConsoleGreen);
@@ -100,22 +241,108 @@ bool TFTPFileServer::FileClose() {
 	return true;
 }
 
-size_t TFTPFileServer::FileRead([[maybe_unused]] void* pBuffer, [[maybe_unused]] size_t nCount, [[maybe_unused]] unsigned nBlockNumber) {
-	DEBUG_ENTRY();
+void TFTPFileServer::FileAbort(uint32_t nSession) {
+	DEBUG_PRINTF("nSession=%u, write_session_=%d, read_session_=%d", nSession, write_session_, read_session_);
 
-	DEBUG_EXIT();
+	if (static_cast<int32_t>(nSession) == read_session_) {
+		read_session_ = -1;
+		return;
+	}
+
+	if (static_cast<int32_t>(nSession) == write_session_) {
+		// The flash content is incomplete, StreamBegin starts again
+		write_session_ = -1;
+
+		TransferEnd();
+		firmware::update::End(false, 0);
+
+		m_nFileSize = 0;
+#if defined (GD32)
+		// Until then, the bootloader must not start the incomplete firmware
+		if (buffer_ == nullptr) {
+			FlashCodeInstall::Get()->Invalidate();
+		}
+#endif
+	}
+}
+
+bool TFTPFileServer::FileAllocate(uint32_t nSession, uint32_t nFileSize) {
+	DEBUG_PRINTF("nSession=%u, nFileSize=%u, m_nSize=%u", nSession, nFileSize, m_nSize);
+
+	if (static_cast<int32_t>(nSession) != write_session_) {
+		return false;
+	}
+
+	if (nFileSize == 0) {
+		return true;
+	}
+
+	if ((nFileSize > m_nSize) || !FlashCodeInstall::Get()->Prepare(nFileSize)) {
+		Display::Get()->TextStatus("TFTP Too large", console::Colours::kConsoleRed);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * The counters of the daemon are since it was started, the difference is of this transfer.
+ */
+void TFTPFileServer::TransferEnd() {
+	const auto& statistics = GetStatistics();
+
+	firmware::update::TransferEnd(m_nFileSize, statistics.retransmits - statistics_begin_.retransmits, statistics.out_of_order - statistics_begin_.out_of_order);
+}
+
+uint32_t TFTPFileServer::FileSize([[maybe_unused]] uint32_t nSession) {
+	return m_nReadSize;
+}
+
+/*
+ * The block is taken straight from the memory-mapped flash, without a copy through FlashCode::Read.
+ */
+size_t TFTPFileServer::FileRead([[maybe_unused]] uint32_t nSession, [[maybe_unused]] void* pBuffer, [[maybe_unused]] size_t nCount, [[maybe_unused]] unsigned nBlockNumber, [[maybe_unused]] size_t nBlockSize) {
+#if defined (GD32)
+	assert(nBlockNumber != 0);
+
+	if (static_cast<int32_t>(nSession) != read_session_) {
+		return 0;
+	}
+
+	const auto nOffset = (nBlockNumber - 1) * nBlockSize;
+
+	if (nOffset >= m_nReadSize) {
+		return 0;
+	}
+
+	if (nCount > (m_nReadSize - nOffset)) {
+		nCount = m_nReadSize - nOffset;
+	}
+
+	memcpy(pBuffer, reinterpret_cast<const void *>(FLASH_BASE + OFFSET_UIMAGE + nOffset), nCount);
+
+	return nCount;
+#else
 	return 0;
+#endif
 }
 
-size_t TFTPFileServer::FileWrite(const void *pBuffer, size_t nCount, unsigned nBlockNumber) {
-	DEBUG_PRINTF("pBuffer=%p, nCount=%d, nBlockNumber=%d (%d)", pBuffer, nCount, nBlockNumber, m_nSize / 512);
+size_t TFTPFileServer::FileWrite(uint32_t nSession, const void *pBuffer, size_t nCount, unsigned nBlockNumber, size_t nBlockSize) {
+	DEBUG_PRINTF("nSession=%u, pBuffer=%p, nCount=%d, nBlockNumber=%d, nBlockSize=%d", nSession, pBuffer, nCount, nBlockNumber, nBlockSize);
 
-	if (nBlockNumber > (m_nSize / 512)) {
-		m_nFileSize = 0;
+	if (static_cast<int32_t>(nSession) != write_session_) {
 		return 0;
 	}
 
 	assert(nBlockNumber != 0);
+	assert(nCount <= nBlockSize);
+
+	const auto nOffset = (nBlockNumber - 1) * nBlockSize;
+
+	if ((nOffset + nCount) > m_nSize) {
+		m_nFileSize = 0;
+		return 0;
+	}
 
 	if (nBlockNumber == 1) {
 		if (!is_valid(pBuffer)) {
@@ -123,13 +350,19 @@ size_t TFTPFileServer::FileWrite(const void *pBuffer, size_t nCount, unsigned nB
 		}
 	}
 
-	const auto nOffset = (nBlockNumber - 1) * 512U;
-
-	assert((nOffset + nCount) <= m_nSize);
+#if defined (GD32)
+	check_.Update(reinterpret_cast<const uint8_t *>(pBuffer), static_cast<uint32_t>(nCount));
+#endif
 
-	memcpy(&buffer_[nOffset], pBuffer, nCount);
+	if (buffer_ != nullptr) {
+		memcpy(&buffer_[nOffset], pBuffer, nCount);
+	} else if (!FlashCodeInstall::Get()->StreamWrite(reinterpret_cast<const uint8_t *>(pBuffer), static_cast<uint32_t>(nCount))) {
+		m_nFileSize = 0;
+		return 0;
+	}
 
-	m_nFileSize += nCount; //FIXME BUG When in retry ?
+	// The blocks are delivered in sequence, a retransmitted block is never written twice
+	m_nFileSize = nOffset + nCount;
 
 	Display::Get()->Progress();
 